@@ -0,0 +1,251 @@
+#include "ans.h"
+
+#include "defines.h"
+#include "header.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BYTE   8
+#define BITMAP (ALPHABET / BYTE) // bytes of the bitmap of present symbols
+
+/* one entry of the decode table */
+typedef struct AnsEntry {
+    uint8_t sym; // symbol decoded in this state
+    uint8_t nbits; // bits read for the next state
+    uint16_t base; // next state before adding those bits
+} AnsEntry;
+
+/* how the encoder moves from a state on a symbol (as in fse) */
+typedef struct AnsStep {
+    uint32_t delta_nbits; // (state + delta_nbits) >> 16 is the number of bits written
+    int32_t delta_find; // (state >> bits written) + delta_find indexes the next states
+} AnsStep;
+
+/* helper function to get the index of the highest set bit of v (> 0) */
+static inline uint32_t high_bit(uint32_t v) {
+    return 31 - (uint32_t) __builtin_clz(v);
+}
+
+/* helper function to scale hist to counts that sum to ANS_STATES, keeping every present symbol
+ * at least 1. the biggest counts absorb the rounding. returns false if hist is empty */
+static bool normalize(const uint64_t hist[static ALPHABET], uint16_t norm[static ALPHABET]) {
+    uint64_t total = 0;
+    for (uint16_t s = 0; s < ALPHABET; s++)
+        total += hist[s];
+    if (total == 0)
+        return false;
+
+    uint32_t sum = 0;
+    uint16_t big = 0;
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        uint64_t n = (hist[s] * ANS_STATES + total / 2) / total;
+        norm[s] = hist[s] == 0 ? 0 : n == 0 ? 1 : (uint16_t) n;
+        sum += norm[s];
+        big = hist[s] > hist[big] ? s : big;
+    }
+
+    /* too many symbols rounded up: take from the biggest counts one at a time */
+    while (sum > ANS_STATES) {
+        uint16_t top = 0;
+        for (uint16_t s = 1; s < ALPHABET; s++)
+            top = norm[s] > norm[top] ? s : top;
+        norm[top]--;
+        sum--;
+    }
+    norm[big] += (uint16_t) (ANS_STATES - sum);
+    return true;
+}
+
+/* helper function to spread the symbols over the states (norm[s] states each) so that every
+ * symbol's states are far apart */
+static void spread(const uint16_t norm[static ALPHABET], uint8_t sym[static ANS_STATES]) {
+    uint32_t pos = 0, step = (ANS_STATES >> 1) + (ANS_STATES >> 3) + 3; // odd, visits every state
+
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        for (uint16_t i = 0; i < norm[s]; i++) {
+            sym[pos] = (uint8_t) s;
+            pos = (pos + step) & (ANS_STATES - 1);
+        }
+    }
+}
+
+/* returns the bits hist would code to as one ans block (block header, checksum and table
+ * included), or UINT64_MAX if hist is empty */
+uint64_t ans_cost(const uint64_t hist[static ALPHABET]) {
+    uint16_t norm[ALPHABET];
+    if (!normalize(hist, norm))
+        return UINT64_MAX;
+
+    double bits = 0;
+    uint16_t unique = 0;
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        if (norm[s] > 0) {
+            bits += hist[s] * (ANS_LOG - log2(norm[s]));
+            unique++;
+        }
+    }
+
+    uint64_t table = sizeof(AnsHeader) + BITMAP + unique * sizeof(uint16_t);
+    return (uint64_t) ceil(bits / BYTE) * BYTE
+           + BYTE * (sizeof(BlockHeader) + sizeof(uint32_t) + table);
+}
+
+/* codes in (size bytes with histogram hist) with table based ans into out (cap bytes): the
+ * AnsHeader, the table and the stream. symbols are coded last to first, so the decoder reads
+ * the stream from its end. returns the bytes in out, or 0 if they do not fit */
+uint64_t ans_encode(const uint8_t *in, uint32_t size, const uint64_t hist[static ALPHABET],
+    uint8_t *out, uint64_t cap) {
+    uint16_t norm[ALPHABET];
+    if (!normalize(hist, norm) || cap < sizeof(AnsHeader) + BITMAP + ALPHABET * sizeof(uint16_t))
+        return 0;
+
+    /* the table: present symbols and their counts */
+    uint64_t len = sizeof(AnsHeader);
+    memset(out + len, 0, BITMAP);
+    len += BITMAP;
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        if (norm[s] > 0) {
+            out[sizeof(AnsHeader) + s / BYTE] |= (uint8_t) (1 << (s % BYTE));
+            memcpy(out + len, &norm[s], sizeof(uint16_t));
+            len += sizeof(uint16_t);
+        }
+    }
+
+    /* the states of each symbol, in order, and how to find them */
+    uint8_t sym[ANS_STATES];
+    uint16_t next[ANS_STATES];
+    uint32_t cumul[ALPHABET];
+    AnsStep steps[ALPHABET];
+    spread(norm, sym);
+    for (uint32_t s = 0, sum = 0; s < ALPHABET; s++) {
+        cumul[s] = sum;
+        if (norm[s] > 0) {
+            uint32_t max_bits = norm[s] == 1 ? ANS_LOG : ANS_LOG - high_bit(norm[s] - 1u);
+            steps[s].delta_nbits = (max_bits << 16) - ((uint32_t) norm[s] << max_bits);
+            steps[s].delta_find = (int32_t) sum - norm[s];
+        }
+        sum += norm[s];
+    }
+    for (uint32_t u = 0; u < ANS_STATES; u++)
+        next[cumul[sym[u]]++] = (uint16_t) (ANS_STATES + u);
+
+    /* code backwards, symbol i with state i % ANS_WAYS. a state sits in [ANS_STATES,
+     * 2 * ANS_STATES) between symbols */
+    uint32_t x[ANS_WAYS], nacc = 0;
+    uint64_t acc = 0, bits = 0;
+    for (uint32_t w = 0; w < ANS_WAYS; w++)
+        x[w] = ANS_STATES;
+    for (uint32_t i = size; i-- > 0;) {
+        AnsStep st = steps[in[i]];
+        uint32_t *xw = &x[i % ANS_WAYS], nbits = (*xw + st.delta_nbits) >> 16;
+        acc |= (uint64_t) (*xw & ((1u << nbits) - 1)) << nacc;
+        nacc += nbits;
+        *xw = next[(int32_t) (*xw >> nbits) + st.delta_find];
+
+        if (nacc >= 32) {
+            if (len + sizeof(uint32_t) > cap)
+                return 0;
+            memcpy(out + len, &acc, sizeof(uint32_t));
+            len += sizeof(uint32_t);
+            bits += 32;
+            acc >>= 32;
+            nacc -= 32;
+        }
+    }
+
+    /* last partial bytes */
+    if (len + (nacc + BYTE - 1) / BYTE > cap)
+        return 0;
+    memcpy(out + len, &acc, (nacc + BYTE - 1) / BYTE);
+    len += (nacc + BYTE - 1) / BYTE;
+    bits += nacc;
+
+    AnsHeader h = { .log = ANS_LOG, .pad = { 0 }, .bits = (uint32_t) bits };
+    for (uint32_t w = 0; w < ANS_WAYS; w++)
+        h.state[w] = (uint16_t) (x[w] - ANS_STATES);
+    memcpy(out, &h, sizeof(AnsHeader));
+    return len;
+}
+
+/* decodes an ans block body (size bytes) into out, which must come out at exactly out_size
+ * bytes. in needs 8 readable bytes past its end. returns false if in is not a valid body */
+bool ans_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size) {
+    AnsHeader h;
+    if (size < sizeof(AnsHeader) + BITMAP)
+        return false;
+    memcpy(&h, in, sizeof(AnsHeader));
+    if (h.log != ANS_LOG)
+        return false;
+    uint32_t x[ANS_WAYS];
+    for (uint32_t w = 0; w < ANS_WAYS; w++) {
+        x[w] = h.state[w];
+        if (x[w] >= ANS_STATES)
+            return false;
+    }
+
+    /* the counts of the present symbols, which must fill the states */
+    uint16_t norm[ALPHABET];
+    uint64_t at = sizeof(AnsHeader) + BITMAP, sum = 0;
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        norm[s] = 0;
+        if (!(in[sizeof(AnsHeader) + s / BYTE] & (1 << (s % BYTE))))
+            continue;
+        if (at + sizeof(uint16_t) > size)
+            return false;
+        memcpy(&norm[s], in + at, sizeof(uint16_t));
+        at += sizeof(uint16_t);
+        if (norm[s] == 0)
+            return false;
+        sum += norm[s];
+    }
+    if (sum != ANS_STATES || h.bits > (size - at) * BYTE)
+        return false;
+
+    /* each state decodes a symbol and says where the next state comes from */
+    uint8_t sym[ANS_STATES];
+    AnsEntry table[ANS_STATES];
+    spread(norm, sym);
+    for (uint32_t u = 0; u < ANS_STATES; u++) {
+        uint32_t state = norm[sym[u]]++; // in [norm, 2 * norm)
+        uint32_t nbits = ANS_LOG - high_bit(state);
+        table[u] = (AnsEntry) { .sym = sym[u],
+            .nbits = (uint8_t) nbits,
+            .base = (uint16_t) ((state << nbits) - ANS_STATES) };
+    }
+
+    /* the stream is read from its end (where the encoder stopped). the states are independent,
+     * so the loads of a round overlap. rounds run unchecked while a round cannot run out of
+     * bits */
+    const uint8_t *stream = in + at;
+    uint64_t pos = h.bits;
+    uint32_t i = 0;
+    for (; i + ANS_WAYS <= out_size && pos >= ANS_WAYS * ANS_LOG; i += ANS_WAYS) {
+        for (uint32_t w = 0; w < ANS_WAYS; w++) {
+            AnsEntry e = table[x[w]];
+            uint64_t word;
+            out[i + w] = e.sym;
+            pos -= e.nbits;
+            memcpy(&word, stream + pos / BYTE, sizeof(word));
+            x[w] = e.base + (uint32_t) ((word >> (pos % BYTE)) & ((1u << e.nbits) - 1));
+        }
+    }
+    for (; i < out_size; i++) {
+        AnsEntry e = table[x[i % ANS_WAYS]];
+        uint64_t word;
+        out[i] = e.sym;
+        if (e.nbits > pos)
+            return false;
+        pos -= e.nbits;
+        memcpy(&word, stream + pos / BYTE, sizeof(word));
+        x[i % ANS_WAYS] = e.base + (uint32_t) ((word >> (pos % BYTE)) & ((1u << e.nbits) - 1));
+    }
+
+    /* back to the states the encoder started in */
+    bool done = pos == 0;
+    for (uint32_t w = 0; w < ANS_WAYS; w++)
+        done = done && x[w] == 0;
+    return done;
+}
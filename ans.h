@@ -0,0 +1,30 @@
+#ifndef __ANS_H__
+#define __ANS_H__
+
+#include "defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ANS_LOG       11 // log2 of the states (and of the sum of the normalized counts)
+#define ANS_STATES    (1 << ANS_LOG)
+#define ANS_WAYS      4 // interleaved states (symbol i uses state i % ANS_WAYS)
+#define ANS_GAIN      50 // ans is picked if it saves more than 1/ANS_GAIN (2%) of huffman's bits
+
+/* start of an ans block body: then a bitmap of the symbols present, the normalized count of
+ * each of them (uint16) and the coded stream */
+typedef struct AnsHeader {
+    uint8_t log; // ANS_LOG
+    uint8_t pad[3];
+    uint32_t bits; // bits in the coded stream
+    uint16_t state[ANS_WAYS]; // states the decoder starts in
+} AnsHeader;
+
+uint64_t ans_cost(const uint64_t hist[static ALPHABET]);
+
+uint64_t ans_encode(const uint8_t *in, uint32_t size, const uint64_t hist[static ALPHABET],
+    uint8_t *out, uint64_t cap);
+
+bool ans_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size);
+
+#endif
@@ -0,0 +1,752 @@
+#include "block.h"
+
+#include "ans.h"
+#include "bwt.h"
+#include "cache.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+#include "kernels.h"
+#include "node.h"
+#include "split.h"
+#include "table.h"
+#include "wide.h"
+#include "words.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BYTE 8
+
+/* most coded bytes of a block: codes never take more than the bytes they code (plus the slack
+ * emit writes past them), and a container adds the header, checksum and tree dump of each of
+ * its blocks (and a bwt row) */
+#define MAX_CODES     (MAX_SEGMENT + EMIT_SLACK)
+#define MAX_CONTAINER \
+    (MAX_CODES + sizeof(uint32_t) \
+        + PLANES_MAX * (sizeof(BlockHeader) + sizeof(uint32_t) + MAX_TREE_SIZE))
+
+/* scratch space for coding a segment */
+typedef struct Scratch {
+    uint8_t *codes; // MAX_SEGMENT + EMIT_SLACK bytes for codes
+    uint8_t *planes; // MAX_SEGMENT bytes for the byte planes of a segment
+    uint8_t *bwt; // MAX_SEGMENT bytes for the transform of a segment (NULL without TRANSFORM_BWT)
+    uint8_t *words; // MAX_SEGMENT + EMIT_SLACK bytes for a words body (NULL without the transform)
+    uint8_t *out; // the coded segment
+    uint64_t size; // bytes in out
+    uint64_t cap; // bytes out can hold
+} Scratch;
+
+/* helper function to append n bytes to the coded segment. returns false if out of memory */
+static bool put(Scratch *s, const void *data, uint64_t n) {
+    if (s->size + n > s->cap) {
+        uint64_t cap = 2 * (s->size + n);
+        uint8_t *grown = (uint8_t *) realloc(s->out, cap);
+        if (!grown)
+            return false;
+        s->out = grown;
+        s->cap = cap;
+    }
+    if (n > 0)
+        memcpy(s->out + s->size, data, n); // blocks without a tree dump pass NULL
+    s->size += n;
+    return true;
+}
+
+/* helper function to append a block: header, checksum of its data, tree dump and codes */
+static bool put_block(Scratch *s, BlockHeader *bh, const uint8_t *data, uint8_t *tree) {
+    uint32_t crc = kernels->crc32c(0, data, bh->size);
+    return put(s, bh, sizeof(BlockHeader)) && put(s, &crc, sizeof(crc))
+           && put(s, tree, bh->tree_size) && put(s, s->codes, bh->comp_size);
+}
+
+/* helper function to append a segment as a huffman block (with its own or a cached table) */
+static bool encode_huffman(
+    Scratch *s, const uint8_t *buf, uint32_t size, uint64_t hist[static ALPHABET], Cache *cache) {
+    PackedCode table[ALPHABET]; // a block of at most MAX_SEGMENT bytes has codes that all pack
+    uint8_t tree[MAX_TREE_SIZE];
+    uint16_t tree_size;
+    uint8_t flags = 0;
+    uint64_t id;
+
+    /* a cached table close enough to this segment saves the tree build and the tree dump */
+    uint64_t bits = 0;
+    if (cache && cache_find(cache, hist, &id, table)) {
+        memcpy(tree, &id, sizeof(id));
+        tree_size = sizeof(id);
+        flags = BLOCK_SHARED;
+        for (uint16_t i = 0; i < ALPHABET; i++)
+            bits += hist[i] * packed_len(table[i]);
+    }
+
+    /* a fresh tree never takes more than a byte a symbol, so its codes fit in s->codes */
+    if (!flags || bits > (uint64_t) MAX_SEGMENT * BYTE) {
+        /* every block gets its own tree and code table */
+        Node *root = build_tree(hist);
+        build_packed(root, table);
+        tree_size = dump_tree(root, tree);
+        delete_tree(&root);
+
+        if (cache)
+            cache_add(cache, hist, tree, tree_size);
+        flags = 0;
+    }
+
+    /* exact size of the codes (known before writing them) */
+    bits = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        bits += hist[i] * packed_len(table[i]);
+
+    BlockHeader bh = { .type = BLOCK_HUFFMAN,
+        .flags = flags | BLOCK_CHECKED,
+        .tree_size = tree_size,
+        .size = size,
+        .comp_size = (uint32_t) ((bits + BYTE - 1) / BYTE) };
+
+    /* a single symbol block has empty codes. the header says it all */
+    uint64_t acc = 0;
+    uint32_t nacc = 0;
+    uint64_t done = kernels->emit(table, buf, size, s->codes, &acc, &nacc);
+    if (nacc > 0)
+        s->codes[done] = (uint8_t) acc; // last partial byte
+
+    return put_block(s, &bh, buf, tree);
+}
+
+/* helper function to return the bits of a byte block with histogram hist in the cheapest
+ * backend allowed. *ans is set if that is ans (which must save 1/ANS_GAIN of the huffman bits
+ * to be picked by BACKEND_AUTO) */
+static uint64_t leaf_cost(uint64_t hist[static ALPHABET], uint8_t backend, bool *ans) {
+    uint64_t huffman = backend == BACKEND_ANS ? UINT64_MAX : split_cost(hist);
+    uint64_t coded = backend == BACKEND_HUFFMAN ? UINT64_MAX : ans_cost(hist);
+    *ans = backend == BACKEND_ANS
+           || (backend == BACKEND_AUTO && coded < huffman - huffman / ANS_GAIN);
+    return *ans ? coded : huffman;
+}
+
+/* helper function to get the byte a block repeats. returns -1 if it has more than one (or none) */
+static int run_symbol(uint64_t hist[static ALPHABET], uint32_t size) {
+    for (uint16_t i = 0; size > 0 && i < ALPHABET; i++)
+        if (hist[i] > 0)
+            return hist[i] == size ? i : -1;
+    return -1;
+}
+
+/* helper function to append a segment of one repeated byte as a run block (no codes) */
+static bool encode_run(Scratch *s, const uint8_t *buf, uint32_t size, uint8_t symbol) {
+    BlockHeader bh = { .type = BLOCK_RUN,
+        .flags = BLOCK_CHECKED,
+        .tree_size = 0,
+        .size = size,
+        .comp_size = sizeof(symbol) };
+    uint32_t crc = kernels->crc32c(0, buf, size);
+    return put(s, &bh, sizeof(BlockHeader)) && put(s, &crc, sizeof(crc))
+           && put(s, &symbol, sizeof(symbol));
+}
+
+/* helper function to append a segment as a run block if it repeats one byte, an ans block if
+ * ans is set (and its codes fit), else as a huffman block */
+static bool encode_leaf(Scratch *s, const uint8_t *buf, uint32_t size,
+    uint64_t hist[static ALPHABET], bool ans, Cache *cache) {
+    int run = run_symbol(hist, size);
+    if (run >= 0)
+        return encode_run(s, buf, size, (uint8_t) run);
+
+    uint64_t n = ans ? ans_encode(buf, size, hist, s->codes, MAX_SEGMENT + EMIT_SLACK) : 0;
+    if (n == 0)
+        return encode_huffman(s, buf, size, hist, cache);
+
+    BlockHeader bh = { .type = BLOCK_ANS,
+        .flags = BLOCK_CHECKED,
+        .tree_size = 0,
+        .size = size,
+        .comp_size = (uint32_t) n };
+    return put_block(s, &bh, buf, NULL);
+}
+
+/* helper function to transform the start of a big segment. returns true if that came out
+ * smaller, so the whole segment is worth sorting */
+static bool bwt_worth(Scratch *s, const uint8_t *buf, uint32_t size) {
+    if (size <= 2 * BWT_PROBE)
+        return true;
+    uint64_t plain[ALPHABET] = { 0 }, coded[ALPHABET] = { 0 };
+    uint32_t primary, n = bwt_transform(buf, BWT_PROBE, s->bwt, MAX_SEGMENT, &primary);
+    kernels->histogram(buf, BWT_PROBE, plain);
+    kernels->histogram(s->bwt, n, coded);
+    return n > 0 && split_cost(coded) < split_cost(plain);
+}
+
+/* helper function to code one segment (already in buf) as a block. the wide symbols, byte
+ * planes and transforms of opts are used instead of bytes if that is smaller, and every block
+ * of bytes is coded with the backend of opts */
+static bool encode_segment(
+    Scratch *s, const uint8_t *buf, uint32_t size, const BlockOptions *opts, Cache *cache) {
+    uint64_t hist[ALPHABET] = { 0 };
+    bool ans;
+    uint8_t width = opts->width, planes = opts->planes;
+    kernels->histogram(buf, size, hist);
+
+    /* one repeated byte (split_input cuts long runs out) is a run block: a byte of body */
+    int run = run_symbol(hist, size);
+    if (run >= 0)
+        return encode_run(s, buf, size, (uint8_t) run);
+    uint64_t best = leaf_cost(hist, opts->backend, &ans); // bits of a byte block
+
+    /* byte planes: one block per plane inside a container (estimated from their histograms) */
+    uint64_t plane_hist[PLANES_MAX][ALPHABET];
+    bool plane_ans[PLANES_MAX], use_planes = false;
+    if (planes > 1 && size >= planes) {
+        kernels->shuffle(buf, size, planes, s->planes);
+
+        uint64_t cost = BYTE * (sizeof(BlockHeader) + sizeof(uint32_t)), off = 0;
+        for (uint8_t p = 0; p < planes; p++) {
+            uint32_t n = plane_size(size, planes, p);
+            memset(plane_hist[p], 0, sizeof(plane_hist[p]));
+            kernels->histogram(s->planes + off, n, plane_hist[p]);
+            cost += leaf_cost(plane_hist[p], opts->backend, &plane_ans[p]);
+            off += n;
+        }
+        use_planes = cost < best;
+        best = use_planes ? cost : best;
+    }
+
+    /* burrows-wheeler transform: a block of the transformed bytes inside a container (after
+     * the row of the input) */
+    uint64_t bwt_hist[ALPHABET] = { 0 };
+    uint32_t bwt_size = 0, primary = 0;
+    bool bwt_ans = false, use_bwt = false;
+    if ((opts->transforms & TRANSFORM_BWT) && size >= BWT_MIN && bwt_worth(s, buf, size))
+        bwt_size = bwt_transform(buf, size, s->bwt, MAX_SEGMENT, &primary);
+    if (bwt_size > 0) {
+        kernels->histogram(s->bwt, bwt_size, bwt_hist);
+        uint64_t cost = BYTE * (sizeof(BlockHeader) + 2 * sizeof(uint32_t))
+                        + leaf_cost(bwt_hist, opts->backend, &bwt_ans);
+        use_bwt = cost < best;
+        use_planes = use_planes && !use_bwt;
+        best = use_bwt ? cost : best;
+    }
+
+    /* word tokens: a vocabulary and a code over it (and the bytes of the rare tokens) */
+    uint64_t words = 0;
+    bool use_words = false;
+    if ((opts->transforms & TRANSFORM_WORDS) && size >= WORDS_MIN)
+        words = words_encode(buf, size, s->words, MAX_SEGMENT + EMIT_SLACK);
+    if (words > 0 && BYTE * (sizeof(BlockHeader) + sizeof(uint32_t) + words) < best) {
+        use_words = true;
+        use_planes = use_bwt = false;
+        best = BYTE * (sizeof(BlockHeader) + sizeof(uint32_t) + words);
+    }
+
+    /* wide symbols win if their codes and table beat the rest */
+    if (width > 1) {
+        uint64_t wide = wide_encode(buf, size, width, s->codes, MAX_SEGMENT + EMIT_SLACK);
+        if (wide > 0 && BYTE * (sizeof(BlockHeader) + sizeof(uint32_t) + wide) < best) {
+            BlockHeader bh = { .type = BLOCK_WIDE,
+                .flags = BLOCK_CHECKED,
+                .tree_size = 0,
+                .size = size,
+                .comp_size = (uint32_t) wide };
+            return put_block(s, &bh, buf, NULL);
+        }
+    }
+
+    if (use_words) {
+        uint32_t crc = kernels->crc32c(0, buf, size);
+        BlockHeader bh = { .type = BLOCK_WORDS,
+            .flags = BLOCK_CHECKED,
+            .tree_size = 0,
+            .size = size,
+            .comp_size = (uint32_t) words };
+        return put(s, &bh, sizeof(BlockHeader)) && put(s, &crc, sizeof(crc))
+               && put(s, s->words, words);
+    }
+
+    if (!use_planes && !use_bwt)
+        return encode_leaf(s, buf, size, hist, ans, cache);
+
+    /* container header first. its size is patched once the planes or transform are coded */
+    uint64_t at = s->size, off = 0;
+    uint32_t crc = kernels->crc32c(0, buf, size);
+    BlockHeader bh = { .type = use_bwt ? BLOCK_BWT : BLOCK_PLANES,
+        .flags = BLOCK_CHECKED,
+        .tree_size = 0,
+        .size = size };
+    bool ok = put(s, &bh, sizeof(BlockHeader)) && put(s, &crc, sizeof(crc));
+
+    if (use_bwt)
+        ok = ok && put(s, &primary, sizeof(primary))
+             && encode_leaf(s, s->bwt, bwt_size, bwt_hist, bwt_ans, cache);
+    for (uint8_t p = 0; ok && use_planes && p < planes; p++) {
+        uint32_t n = plane_size(size, planes, p);
+        ok = encode_leaf(s, s->planes + off, n, plane_hist[p], plane_ans[p], cache);
+        off += n;
+    }
+
+    bh.comp_size = (uint32_t) (s->size - at - sizeof(BlockHeader) - sizeof(crc));
+    memcpy(s->out + at, &bh, sizeof(BlockHeader));
+    return ok;
+}
+
+/* helper function to allocate the scratch space for what opts tries. returns false if out of
+ * memory (what was allocated is freed by scratch_free) */
+static bool scratch_init(Scratch *s, const BlockOptions *opts) {
+    *s = (Scratch) { .codes = (uint8_t *) calloc(MAX_SEGMENT + EMIT_SLACK, sizeof(uint8_t)),
+        .planes = (uint8_t *) calloc(MAX_SEGMENT, sizeof(uint8_t)),
+        .bwt = opts->transforms & TRANSFORM_BWT ? (uint8_t *) calloc(MAX_SEGMENT, sizeof(uint8_t))
+                                                : NULL,
+        .words = opts->transforms & TRANSFORM_WORDS
+                     ? (uint8_t *) calloc(MAX_SEGMENT + EMIT_SLACK, sizeof(uint8_t))
+                     : NULL,
+        .out = NULL,
+        .size = 0,
+        .cap = 0 };
+    return s->codes && s->planes && (s->bwt || !(opts->transforms & TRANSFORM_BWT))
+           && (s->words || !(opts->transforms & TRANSFORM_WORDS));
+}
+
+/* helper function to free scratch space */
+static void scratch_free(Scratch *s) {
+    free(s->codes);
+    free(s->planes);
+    free(s->bwt);
+    free(s->words);
+    free(s->out);
+    return;
+}
+
+/* helper function to code the segments of infile (read from the current offset) as blocks,
+ * without the end of the stream. returns the number of bytes written to outfile */
+static uint64_t encode_blocks(int infile, int outfile, Segment *segs, uint32_t nsegs,
+    const BlockOptions *opts, Cache *cache) {
+    uint8_t *buffer = (uint8_t *) calloc(MAX_SEGMENT, sizeof(uint8_t)); // ~1MB of mem
+    Scratch s;
+    uint64_t comp_fz = 0;
+    bool ok = scratch_init(&s, opts) && buffer;
+
+    for (uint32_t i = 0; ok && i < nsegs; i++) {
+        uint32_t size = (uint32_t) read_bytes(infile, buffer, segs[i].size);
+        s.size = 0;
+        ok = encode_segment(&s, buffer, size, opts, cache);
+        if (ok)
+            comp_fz += write_bytes(outfile, s.out, s.size);
+    }
+
+    free(buffer);
+    scratch_free(&s);
+    return comp_fz;
+}
+
+/* helper function to get a monotonic time in ms */
+static uint64_t now_ms(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000 + (uint64_t) t.tv_nsec / 1000000;
+}
+
+/* helper function to end a block stream: the index of its n segments (if it has more than
+ * one), then BLOCK_END, whose comp_size is the bytes of the index block before it. returns the
+ * number of bytes written to outfile */
+static uint64_t end_stream(int outfile, const IndexEntry *index, uint32_t n) {
+    uint64_t comp_fz = 0;
+    BlockHeader end = { .type = BLOCK_END, .flags = 0, .tree_size = 0, .size = 0, .comp_size = 0 };
+
+    if (n > 1) {
+        BlockHeader ih = { .type = BLOCK_INDEX,
+            .flags = 0,
+            .tree_size = 0,
+            .size = 0,
+            .comp_size = n * (uint32_t) sizeof(IndexEntry) };
+        comp_fz += write_bytes(outfile, (uint8_t *) &ih, sizeof(BlockHeader));
+        comp_fz += write_bytes(outfile, (uint8_t *) index, ih.comp_size);
+        end.comp_size = (uint32_t) comp_fz;
+    }
+
+    comp_fz += write_bytes(outfile, (uint8_t *) &end, sizeof(BlockHeader));
+    return comp_fz;
+}
+
+/* codes the segments of infile (read from the current offset) as a block stream, trying what
+ * opts asks for. tables are looked up in and added to cache (if not NULL). returns the number
+ * of bytes written to outfile */
+uint64_t block_encode(int infile, int outfile, Segment *segs, uint32_t nsegs,
+    const BlockOptions *opts, Cache *cache) {
+    uint64_t comp_fz = encode_blocks(infile, outfile, segs, nsegs, opts, cache);
+    return comp_fz + end_stream(outfile, NULL, 0);
+}
+
+/* codes infile as a block stream while it is read (a socket or pipe carrying messages), after
+ * the Header the caller wrote. what came in is flushed as a block and a BLOCK_SYNC marker, so
+ * the receiver can decode it all without waiting for more, once flush_bytes (at most
+ * MAX_SEGMENT) came in, flush_ms ms after the first of them came in (0 for no timer) and at
+ * EOF. *size is set to the bytes read. returns the number of bytes written to outfile or -1 on
+ * error */
+int64_t block_stream(int infile, int outfile, uint32_t flush_bytes, uint32_t flush_ms,
+    const BlockOptions *opts, Cache *cache, uint64_t *size) {
+    uint8_t *buffer = (uint8_t *) calloc(MAX_SEGMENT, sizeof(uint8_t)); // ~1MB of mem
+    Scratch s;
+    uint64_t comp_fz = 0, first = 0; // first: when the oldest byte not flushed came in
+    uint32_t len = 0, limit = flush_bytes < MAX_SEGMENT ? flush_bytes : MAX_SEGMENT;
+    bool ok = scratch_init(&s, opts) && buffer && limit > 0, eof = false;
+    BlockHeader sync
+        = { .type = BLOCK_SYNC, .flags = 0, .tree_size = 0, .size = 0, .comp_size = 0 };
+
+    *size = 0;
+    while (ok && !eof) {
+        /* wait for input no longer than the timer has left */
+        int wait = -1;
+        if (len > 0 && flush_ms > 0) {
+            uint64_t waited = now_ms() - first;
+            wait = waited >= flush_ms ? 0 : (int) (flush_ms - waited);
+        }
+
+        int got = read_within(infile, buffer + len, (int) (limit - len), wait);
+        if (got > 0) {
+            first = len == 0 ? now_ms() : first;
+            len += (uint32_t) got;
+            *size += (uint64_t) got;
+        }
+        eof = got == 0;
+
+        /* flush: full, timed out or at the end */
+        bool due = flush_ms > 0 && now_ms() - first >= flush_ms;
+        if (len > 0 && (len == limit || due || eof)) {
+            s.size = 0;
+            ok = encode_segment(&s, buffer, len, opts, cache)
+                 && write_bytes(outfile, s.out, (int) s.size) == (int) s.size
+                 && write_bytes(outfile, (uint8_t *) &sync, sizeof(BlockHeader))
+                        == sizeof(BlockHeader);
+            comp_fz += s.size + sizeof(BlockHeader);
+            len = 0;
+        }
+    }
+
+    free(buffer);
+    scratch_free(&s);
+    return ok ? (int64_t) (comp_fz + end_stream(outfile, NULL, 0)) : -1;
+}
+
+/* helper function to find the end of the block stream whose Header is at start in fd, reading
+ * only the block headers. *size is set to the bytes its blocks decode to. returns the offset
+ * just past its BLOCK_END, or -1 */
+static int64_t stream_end(int fd, uint64_t start, uint64_t *size) {
+    BlockHeader bh;
+    uint64_t at = start + sizeof(Header);
+
+    *size = 0;
+    while (lseek(fd, (off_t) at, SEEK_SET) != -1
+           && read_bytes(fd, (uint8_t *) &bh, sizeof(BlockHeader)) == sizeof(BlockHeader)) {
+        at += sizeof(BlockHeader);
+        if (bh.type == BLOCK_END)
+            return (int64_t) at;
+        if (!block_valid(&bh))
+            return -1;
+        at += block_body_size(&bh);
+        *size += bh.size;
+    }
+    return -1;
+}
+
+/* appends the segments of infile (size bytes, read from the current offset) to the block
+ * stream in outfile (open for reading and writing) as a new segment, coded as block_encode
+ * would. if outfile is several streams concatenated, the last one grows. the blocks already
+ * there are not recoded: the new ones go over the old end of the stream, followed by the index
+ * of every segment, and the Header's file_size grows by size (a stream written by block_stream
+ * keeps STREAM_SIZE). returns the new size of outfile,
+ * or -1 if it is not a block stream (or on error) */
+int64_t block_append(int infile, int outfile, Segment *segs, uint32_t nsegs, uint64_t size,
+    const BlockOptions *opts, Cache *cache) {
+    Header h;
+    BlockHeader end, ih = { 0 };
+    off_t fz = lseek(outfile, 0, SEEK_END);
+    if (fz < (off_t) (sizeof(Header) + sizeof(BlockHeader)))
+        return -1;
+
+    /* walk the concatenated streams (by their block headers) to the Header of the last one */
+    uint64_t start = 0, decoded = 0; // decoded: bytes of the last stream's blocks
+    int64_t next = 0;
+    while (next >= 0 && next < (int64_t) fz) {
+        start = (uint64_t) next;
+        if (lseek(outfile, (off_t) start, SEEK_SET) == -1
+            || read_bytes(outfile, (uint8_t *) &h, sizeof(Header)) != sizeof(Header)
+            || h.magic != BLOCK_MAGIC)
+            return -1;
+        next = stream_end(outfile, start, &decoded);
+    }
+    if (next != (int64_t) fz || lseek(outfile, fz - (off_t) sizeof(BlockHeader), SEEK_SET) == -1
+        || read_bytes(outfile, (uint8_t *) &end, sizeof(BlockHeader)) != sizeof(BlockHeader))
+        return -1;
+
+    /* the segments so far: from the index before the end, or the whole stream as one */
+    uint64_t at = (uint64_t) fz - sizeof(BlockHeader); // where the new blocks go
+    uint32_t n = 1;
+    if (end.comp_size > 0) {
+        if (end.comp_size > at - start - sizeof(Header))
+            return -1;
+        at -= end.comp_size;
+        if (lseek(outfile, (off_t) at, SEEK_SET) == -1
+            || read_bytes(outfile, (uint8_t *) &ih, sizeof(BlockHeader)) != sizeof(BlockHeader)
+            || ih.type != BLOCK_INDEX || ih.comp_size != end.comp_size - sizeof(BlockHeader)
+            || ih.comp_size % sizeof(IndexEntry) != 0)
+            return -1;
+        n = ih.comp_size / sizeof(IndexEntry);
+    }
+
+    IndexEntry *index = (IndexEntry *) malloc((n + 1) * sizeof(IndexEntry));
+    if (!index)
+        return -1;
+    if (end.comp_size > 0) {
+        if (read_bytes(outfile, (uint8_t *) index, ih.comp_size) != (int) ih.comp_size) {
+            free(index);
+            return -1;
+        }
+    } else {
+        index[0] = (IndexEntry) { .offset = sizeof(Header), .size = decoded };
+    }
+    index[n++] = (IndexEntry) { .offset = at - start, .size = size };
+
+    /* new blocks over the old index and end, then the new ones */
+    uint64_t comp_fz = 0;
+    bool ok = lseek(outfile, (off_t) at, SEEK_SET) != -1;
+    if (ok) {
+        comp_fz = encode_blocks(infile, outfile, segs, nsegs, opts, cache);
+        comp_fz += end_stream(outfile, index, n);
+        ok = ftruncate(outfile, (off_t) (at + comp_fz)) == 0;
+    }
+    free(index);
+
+    /* the header covers every segment (a stream's size was never known) */
+    if (h.file_size != STREAM_SIZE)
+        h.file_size += size;
+    ok = ok && lseek(outfile, (off_t) start, SEEK_SET) == (off_t) start
+         && write_bytes(outfile, (uint8_t *) &h, sizeof(Header)) == sizeof(Header);
+    return ok ? (int64_t) (at + comp_fz) : -1;
+}
+
+/* returns true if a block header (other than BLOCK_END) has sizes that can be right. the body
+ * of every block but an index is then small enough to be read whole */
+bool block_valid(const BlockHeader *bh) {
+    if (bh->type == BLOCK_INDEX)
+        return bh->size == 0 && bh->tree_size == 0 && bh->flags == 0;
+    if (bh->type == BLOCK_SYNC)
+        return bh->size == 0 && bh->tree_size == 0 && bh->flags == 0 && bh->comp_size == 0;
+    if (bh->type == BLOCK_RUN)
+        return bh->size <= MAX_SEGMENT && bh->tree_size == 0 && bh->comp_size == sizeof(uint8_t)
+               && !(bh->flags & BLOCK_SHARED);
+    if (bh->type == BLOCK_PLANES || bh->type == BLOCK_BWT)
+        return bh->size <= MAX_SEGMENT && bh->tree_size == 0 && bh->comp_size <= MAX_CONTAINER
+               && !(bh->flags & BLOCK_SHARED);
+    if (bh->type == BLOCK_WIDE || bh->type == BLOCK_ANS || bh->type == BLOCK_WORDS)
+        return bh->size <= MAX_SEGMENT && bh->tree_size == 0 && bh->comp_size <= MAX_CODES
+               && !(bh->flags & BLOCK_SHARED);
+    return bh->type == BLOCK_HUFFMAN && bh->size <= MAX_SEGMENT && bh->tree_size <= MAX_TREE_SIZE
+           && bh->comp_size <= MAX_CODES
+           && (!(bh->flags & BLOCK_SHARED) || bh->tree_size == sizeof(uint64_t));
+}
+
+/* returns the bytes of a block after its header (checksum, tree dump and codes). an index
+ * holds an entry per segment, so its body can be larger than a read or a buffer */
+uint64_t block_body_size(const BlockHeader *bh) {
+    uint64_t check = bh->flags & BLOCK_CHECKED ? sizeof(uint32_t) : 0;
+    return check + bh->tree_size + bh->comp_size;
+}
+
+/* helper function to decode the body of a huffman block (tree dump then codes) */
+static bool decode_huffman(const BlockHeader *bh, uint8_t *body, uint8_t *out, Cache *cache) {
+    Node *root;
+    if (bh->flags & BLOCK_SHARED) {
+        uint64_t id;
+        memcpy(&id, body, sizeof(id));
+        root = cache_tree(cache, id); // NULL if there is no cache or it lacks the table
+    } else {
+        root = rebuild_tree(bh->tree_size, body);
+    }
+    if (!root)
+        return false;
+    DecodeTable *table = table_create(root);
+    uint64_t at = 0, got = 0;
+
+    if (table)
+        got = table_decode(
+            table, body + bh->tree_size, (uint64_t) bh->comp_size * BYTE, &at, out, bh->size);
+
+    table_delete(&table);
+    delete_tree(&root);
+    return got == bh->size; // codes ran out if less
+}
+
+/* helper function to decode the body of a byte plane container (a block for every plane) */
+static bool decode_planes(const BlockHeader *bh, uint8_t *body, uint8_t *out, Cache *cache) {
+    BlockHeader pbh[PLANES_MAX];
+    uint64_t at = 0, off = 0;
+    uint8_t n = 0;
+
+    /* the planes are whole blocks that fill the container (and are not containers) */
+    while (at < bh->comp_size) {
+        if (n == PLANES_MAX || at + sizeof(BlockHeader) > bh->comp_size)
+            return false;
+        memcpy(&pbh[n], body + at, sizeof(BlockHeader));
+        if (pbh[n].type == BLOCK_PLANES || pbh[n].type == BLOCK_BWT || !block_valid(&pbh[n]))
+            return false;
+        at += sizeof(BlockHeader) + block_body_size(&pbh[n++]);
+    }
+    if (at != bh->comp_size || n < 2)
+        return false;
+    for (uint8_t p = 0; p < n; p++)
+        if (pbh[p].size != plane_size(bh->size, n, p))
+            return false;
+
+    uint8_t *planes = (uint8_t *) malloc(bh->size);
+    bool ok = planes != NULL;
+
+    at = 0;
+    for (uint8_t p = 0; ok && p < n; p++) {
+        ok = block_decode_body(&pbh[p], body + at + sizeof(BlockHeader), planes + off, cache);
+        at += sizeof(BlockHeader) + block_body_size(&pbh[p]);
+        off += pbh[p].size;
+    }
+    if (ok)
+        kernels->unshuffle(planes, bh->size, n, out);
+
+    free(planes);
+    return ok;
+}
+
+/* helper function to decode the body of a transform container (the row of the input, then a
+ * huffman block of the transformed bytes) */
+static bool decode_bwt(const BlockHeader *bh, uint8_t *body, uint8_t *out, Cache *cache) {
+    BlockHeader tbh;
+    uint32_t primary;
+    if (bh->comp_size < sizeof(primary) + sizeof(BlockHeader))
+        return false;
+    memcpy(&primary, body, sizeof(primary));
+    memcpy(&tbh, body + sizeof(primary), sizeof(BlockHeader));
+
+    /* the transformed bytes are one huffman or ans block that fills the container */
+    if ((tbh.type != BLOCK_HUFFMAN && tbh.type != BLOCK_ANS) || !block_valid(&tbh) || tbh.size == 0
+        || sizeof(primary) + sizeof(BlockHeader) + block_body_size(&tbh) != bh->comp_size)
+        return false;
+
+    uint8_t *bwt = (uint8_t *) malloc(tbh.size);
+    bool ok = bwt != NULL
+              && block_decode_body(&tbh, body + sizeof(primary) + sizeof(BlockHeader), bwt, cache)
+              && bwt_inverse(bwt, tbh.size, primary, out, bh->size);
+
+    free(bwt);
+    return ok;
+}
+
+/* decodes the body of a block (checksum, then the tree dump and codes or what its type has)
+ * into out, which has room for bh->size bytes. body needs TABLE_SLACK readable bytes past its
+ * end. shared tables are looked up in cache. returns false on error (including a checksum
+ * mismatch) */
+bool block_decode_body(const BlockHeader *bh, uint8_t *body, uint8_t *out, Cache *cache) {
+    uint32_t crc = 0;
+    if (bh->flags & BLOCK_CHECKED) {
+        memcpy(&crc, body, sizeof(crc));
+        body += sizeof(crc);
+    }
+
+    bool ok;
+    switch (bh->type) {
+    case BLOCK_WIDE: ok = wide_decode(body, bh->comp_size, out, bh->size); break;
+    case BLOCK_PLANES: ok = decode_planes(bh, body, out, cache); break;
+    case BLOCK_BWT: ok = decode_bwt(bh, body, out, cache); break;
+    case BLOCK_ANS: ok = ans_decode(body, bh->comp_size, out, bh->size); break;
+    case BLOCK_WORDS: ok = words_decode(body, bh->comp_size, out, bh->size); break;
+    case BLOCK_RUN:
+        memset(out, body[0], bh->size);
+        ok = true;
+        break;
+    case BLOCK_INDEX: ok = true; break; // no data (the segments are decoded one after another)
+    case BLOCK_SYNC: ok = true; break; // no data (block_decode flushes the output)
+    default: ok = decode_huffman(bh, body, out, cache); break;
+    }
+
+    return ok && (!(bh->flags & BLOCK_CHECKED) || kernels->crc32c(0, out, bh->size) == crc);
+}
+
+/* helper function to read past n bytes of infile through buf (size bytes). returns false if
+ * infile ends first */
+static bool skip_bytes(int infile, uint64_t n, uint8_t *buf, uint32_t size) {
+    while (n > 0) {
+        int want = n < size ? (int) n : (int) size;
+        if (read_bytes(infile, buf, want) != want)
+            return false;
+        n -= (uint64_t) want;
+    }
+    return true;
+}
+
+/* decodes a block stream (after its Header) from infile to outfile, with shared tables from
+ * cache. comp_fz is incremented by the bytes read. returns bytes decoded or -1 on error */
+int64_t block_decode(int infile, int outfile, uint64_t *comp_fz, Cache *cache) {
+    uint8_t *body = NULL, *out = (uint8_t *) calloc(MAX_SEGMENT, sizeof(uint8_t));
+    uint64_t body_cap = 0;
+    int64_t tot_decoded = 0;
+    BlockHeader bh;
+
+    while (out) {
+        if (read_bytes(infile, (uint8_t *) &bh, sizeof(BlockHeader)) != sizeof(BlockHeader))
+            break; // truncated stream
+        *comp_fz += sizeof(BlockHeader);
+
+        /* done with the stream */
+        if (bh.type == BLOCK_END) {
+            free(body);
+            free(out);
+            return tot_decoded;
+        }
+
+        /* unknown block or sizes that cannot be right */
+        if (!block_valid(&bh))
+            break;
+
+        /* an index is only for seeking readers. it is read through, not kept */
+        uint64_t body_size = block_body_size(&bh);
+        if (bh.type == BLOCK_INDEX) {
+            if (!skip_bytes(infile, body_size, out, MAX_SEGMENT))
+                break;
+            *comp_fz += body_size;
+            continue;
+        }
+
+        /* grow the body buffer if needed (zeroed slack for the table lookups) */
+        if (body_size + TABLE_SLACK > body_cap) {
+            uint8_t *grown = (uint8_t *) realloc(body, body_size + TABLE_SLACK);
+            if (!grown)
+                break;
+            body = grown;
+            body_cap = body_size + TABLE_SLACK;
+        }
+
+        if ((uint64_t) read_bytes(infile, body, (int) body_size) != body_size)
+            break;
+        *comp_fz += body_size;
+        memset(body + body_size, 0, TABLE_SLACK);
+
+        /* decoded straight into what goes to a spliced pipe, else into out */
+        uint8_t *window = io_window(outfile, bh.size);
+        if (!block_decode_body(&bh, body, window ? window : out, cache))
+            break;
+
+        if (window)
+            io_commit(outfile, bh.size);
+        else if ((uint32_t) write_bytes(outfile, out, (int) bh.size) != bh.size)
+            break; // the output is full
+        tot_decoded += bh.size;
+
+        /* the sender flushed: so does the receiver, whatever it is holding back */
+        if (bh.type == BLOCK_SYNC && !io_flush(outfile))
+            break;
+    }
+
+    free(body);
+    free(out);
+    return -1;
+}
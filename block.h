@@ -0,0 +1,45 @@
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+#include "cache.h"
+#include "header.h"
+#include "split.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* transforms tried by block_encode */
+#define TRANSFORM_BWT   0x01 // burrows-wheeler, move-to-front and zero runs (for text)
+#define TRANSFORM_WORDS 0x02 // word and separator tokens coded over a vocabulary (for logs)
+
+/* entropy coders for the blocks of bytes */
+#define BACKEND_AUTO    0 // ans where it saves enough over huffman, else huffman
+#define BACKEND_HUFFMAN 1
+#define BACKEND_ANS     2
+
+/* what block_encode tries for every segment */
+typedef struct BlockOptions {
+    uint8_t width; // bytes per wide symbol (1 for none)
+    uint8_t planes; // bytes per element split into byte planes (1 for none)
+    uint8_t transforms; // TRANSFORM_* tried
+    uint8_t backend; // BACKEND_* of the blocks of bytes
+} BlockOptions;
+
+uint64_t block_encode(int infile, int outfile, Segment *segs, uint32_t nsegs,
+    const BlockOptions *opts, Cache *cache);
+
+int64_t block_stream(int infile, int outfile, uint32_t flush_bytes, uint32_t flush_ms,
+    const BlockOptions *opts, Cache *cache, uint64_t *size);
+
+int64_t block_append(int infile, int outfile, Segment *segs, uint32_t nsegs, uint64_t size,
+    const BlockOptions *opts, Cache *cache);
+
+bool block_valid(const BlockHeader *bh);
+
+uint64_t block_body_size(const BlockHeader *bh);
+
+bool block_decode_body(const BlockHeader *bh, uint8_t *body, uint8_t *out, Cache *cache);
+
+int64_t block_decode(int infile, int outfile, uint64_t *comp_fz, Cache *cache);
+
+#endif
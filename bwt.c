@@ -0,0 +1,294 @@
+#include "bwt.h"
+
+#include "defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY  UINT32_MAX // suffix array slot not filled yet
+#define RUN_A  0 // zero run digit worth 1 (times its place)
+#define RUN_B  1 // zero run digit worth 2 (times its place)
+#define ESCAPE 255 // the two largest move-to-front indexes: ESCAPE then 0 or 1
+
+/* helper function to set bkt[c] to the start (or end) of the bucket of c in the suffix array
+ * of s (n symbols below k) */
+static void buckets(const uint32_t *s, uint32_t n, uint32_t k, uint32_t *bkt, bool end) {
+    memset(bkt, 0, k * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; i++)
+        bkt[s[i]]++;
+    for (uint32_t c = 0, sum = 0; c < k; c++) {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+/* helper function to induce the order of the L-type suffixes from the sorted ones in sa, then
+ * the S-type suffixes from the L-type ones */
+static void induce(const uint32_t *s, uint32_t *sa, const bool *stype, uint32_t n, uint32_t k,
+    uint32_t *bkt) {
+    buckets(s, n, k, bkt, false);
+    for (uint32_t i = 0; i < n; i++)
+        if (sa[i] != EMPTY && sa[i] > 0 && !stype[sa[i] - 1])
+            sa[bkt[s[sa[i] - 1]]++] = sa[i] - 1;
+
+    buckets(s, n, k, bkt, true);
+    for (uint32_t i = n; i-- > 0;)
+        if (sa[i] != EMPTY && sa[i] > 0 && stype[sa[i] - 1])
+            sa[--bkt[s[sa[i] - 1]]] = sa[i] - 1;
+}
+
+/* helper function to build the suffix array of s (n symbols below k, ending in a unique 0) by
+ * induced sorting: the leftmost S-type suffixes are sorted by their substrings, recursing on
+ * their names if any repeat, and the rest of the suffixes are induced from them. returns false
+ * if out of memory */
+static bool suffix_array(const uint32_t *s, uint32_t *sa, uint32_t n, uint32_t k) {
+    bool *stype = (bool *) malloc(n * sizeof(bool));
+    uint32_t *bkt = (uint32_t *) malloc(k * sizeof(uint32_t));
+    if (!stype || !bkt) {
+        free(stype);
+        free(bkt);
+        return false;
+    }
+
+    /* a suffix is S-type if it is smaller than the one after it */
+    stype[n - 1] = true;
+    for (uint32_t i = n - 1; i-- > 0;)
+        stype[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && stype[i + 1]);
+#define LMS(i) ((i) > 0 && stype[i] && !stype[(i) - 1])
+
+    /* sort the lms substrings: lms suffixes at the ends of their buckets, then induce */
+    buckets(s, n, k, bkt, true);
+    for (uint32_t i = 0; i < n; i++)
+        sa[i] = EMPTY;
+    for (uint32_t i = 1; i < n; i++)
+        if (LMS(i))
+            sa[--bkt[s[i]]] = i;
+    induce(s, sa, stype, n, k, bkt);
+
+    /* gather the sorted lms substrings at the front and name them (equal substrings share a
+     * name). the names go in sa past them, in string order */
+    uint32_t n1 = 0;
+    for (uint32_t i = 0; i < n; i++)
+        if (LMS(sa[i]))
+            sa[n1++] = sa[i];
+    for (uint32_t i = n1; i < n; i++)
+        sa[i] = EMPTY;
+
+    uint32_t names = 0, prev = EMPTY;
+    for (uint32_t i = 0; i < n1; i++) {
+        uint32_t pos = sa[i];
+        bool diff = prev == EMPTY;
+        for (uint32_t d = 0; !diff; d++) {
+            if (s[pos + d] != s[prev + d] || stype[pos + d] != stype[prev + d])
+                diff = true;
+            else if (d > 0 && (LMS(pos + d) || LMS(prev + d)))
+                break;
+        }
+        if (diff) {
+            names++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = names - 1;
+    }
+    for (uint32_t i = n, j = n; i-- > n1;)
+        if (sa[i] != EMPTY)
+            sa[--j] = sa[i];
+
+    /* order the lms suffixes: directly if every name is distinct, else by recursion */
+    uint32_t *s1 = sa + n - n1;
+    bool ok = true;
+    if (names < n1)
+        ok = suffix_array(s1, sa, n1, names);
+    else
+        for (uint32_t i = 0; i < n1; i++)
+            sa[s1[i]] = i;
+
+    /* put the sorted lms suffixes at the ends of their buckets and induce the rest */
+    if (ok) {
+        buckets(s, n, k, bkt, true);
+        for (uint32_t i = 1, j = 0; i < n; i++)
+            if (LMS(i))
+                s1[j++] = i;
+        for (uint32_t i = 0; i < n1; i++)
+            sa[i] = s1[sa[i]];
+        for (uint32_t i = n1; i < n; i++)
+            sa[i] = EMPTY;
+        for (uint32_t i = n1; i-- > 0;) {
+            uint32_t j = sa[i];
+            sa[i] = EMPTY;
+            sa[--bkt[s[j]]] = j;
+        }
+        induce(s, sa, stype, n, k, bkt);
+    }
+#undef LMS
+
+    free(stype);
+    free(bkt);
+    return ok;
+}
+
+/* helper function to append a run of zeros (run > 0) as RUN_A and RUN_B digits of bijective
+ * base 2, least significant first. returns false if out is full */
+static bool put_run(uint8_t *out, uint32_t cap, uint32_t *at, uint32_t run) {
+    for (run--;; run = (run - 2) / 2) {
+        if (*at == cap)
+            return false;
+        out[(*at)++] = run & 1 ? RUN_B : RUN_A;
+        if (run < 2)
+            return true;
+    }
+}
+
+/* burrows-wheeler transforms in (size bytes) and codes the last column with move-to-front
+ * indexes and zero runs into out (cap bytes). the rows are the suffixes of in followed by an end
+ * of string smaller than any byte. the end of string itself is left out of the last column and
+ * *primary is set to its row. returns the bytes in out, or 0 if they do not fit (or out of
+ * memory) */
+uint32_t bwt_transform(
+    const uint8_t *in, uint32_t size, uint8_t *out, uint32_t cap, uint32_t *primary) {
+    if (size == 0)
+        return 0;
+    uint32_t n = size + 1;
+    uint32_t *s = (uint32_t *) malloc(n * sizeof(uint32_t));
+    uint32_t *sa = (uint32_t *) malloc(n * sizeof(uint32_t));
+    bool ok = s && sa;
+
+    /* bytes shift up one to make room for the end of string */
+    for (uint32_t i = 0; ok && i < size; i++)
+        s[i] = in[i] + 1u;
+    if (ok) {
+        s[size] = 0;
+        ok = suffix_array(s, sa, n, ALPHABET + 1);
+    }
+
+    uint8_t list[ALPHABET];
+    for (uint16_t c = 0; c < ALPHABET; c++)
+        list[c] = (uint8_t) c;
+
+    uint32_t at = 0, run = 0;
+    for (uint32_t j = 0; ok && j < n; j++) {
+        if (sa[j] == 0) {
+            *primary = j;
+            continue;
+        }
+        uint8_t c = in[sa[j] - 1]; // last column
+
+        /* repeats of the front symbol become runs */
+        if (list[0] == c) {
+            run++;
+            continue;
+        }
+        if (run > 0)
+            ok = put_run(out, cap, &at, run);
+        run = 0;
+
+        uint32_t v = (uint32_t) ((uint8_t *) memchr(list, c, ALPHABET) - list);
+        memmove(list + 1, list, v);
+        list[0] = c;
+
+        /* indexes 1..253 shift past the run digits. 254 and 255 take an escape */
+        if (ok && v < ESCAPE - 1 && at < cap)
+            out[at++] = (uint8_t) (v + 1);
+        else if (ok && at + 1 < cap) {
+            out[at++] = ESCAPE;
+            out[at++] = (uint8_t) (v - (ESCAPE - 1));
+        } else
+            ok = false;
+    }
+    if (ok && run > 0)
+        ok = put_run(out, cap, &at, run);
+
+    free(s);
+    free(sa);
+    return ok ? at : 0;
+}
+
+/* undoes bwt_transform: in (size bytes) is decoded into out, which must come out at exactly
+ * out_size (< 2^24) bytes. returns false if in cannot be the transform of out_size bytes */
+bool bwt_inverse(
+    const uint8_t *in, uint32_t size, uint32_t primary, uint8_t *out, uint32_t out_size) {
+    if (primary == 0 || primary > out_size || out_size >= 1u << 24)
+        return false; // row 0 is the suffix that is just the end of string
+    uint8_t *last = (uint8_t *) malloc(out_size);
+    uint32_t *next = (uint32_t *) malloc(((uint64_t) out_size + 1) * sizeof(uint32_t));
+    if (!last || !next) {
+        free(last);
+        free(next);
+        return false;
+    }
+
+    uint8_t list[ALPHABET];
+    for (uint16_t c = 0; c < ALPHABET; c++)
+        list[c] = (uint8_t) c;
+
+    /* move-to-front indexes and zero runs back to the last column */
+    uint64_t run = 0, weight = 1;
+    uint32_t at = 0;
+    bool ok = true;
+    for (uint32_t i = 0; ok && i <= size; i++) {
+        if (i < size && in[i] <= RUN_B) {
+            run += weight << in[i];
+            weight <<= 1;
+            ok = run <= out_size;
+            continue;
+        }
+        if (run > out_size - at) {
+            ok = false;
+            break;
+        }
+        memset(last + at, list[0], run);
+        at += (uint32_t) run;
+        run = 0;
+        weight = 1;
+        if (i == size)
+            break;
+
+        uint32_t v = in[i] - 1u;
+        if (in[i] == ESCAPE) {
+            ok = i + 1 < size && in[i + 1] <= 1;
+            v = ok ? ESCAPE - 1u + in[++i] : 0;
+        }
+        if (!ok || at == out_size) {
+            ok = false;
+            break;
+        }
+        uint8_t c = list[v];
+        memmove(list + 1, list, v);
+        list[0] = c;
+        last[at++] = c;
+    }
+    ok = ok && at == out_size;
+
+    /* next[r] is the row of the suffix one byte shorter than the one in row r (shifted past
+     * the last column of that row, so a step is one load). the end of string sorts first and
+     * the whole input is in row primary (< 2^24 rows) */
+    if (ok) {
+        uint32_t start[ALPHABET] = { 0 };
+        for (uint32_t i = 0; i < out_size; i++)
+            start[last[i]]++;
+        for (uint32_t c = 0, sum = 1; c < ALPHABET; c++) {
+            uint32_t t = start[c];
+            start[c] = sum;
+            sum += t;
+        }
+        next[0] = primary << 8;
+        for (uint32_t r = 0; r <= out_size; r++) {
+            if (r == primary)
+                continue;
+            uint8_t c = last[r < primary ? r : r - 1];
+            next[start[c]++] = r << 8 | c;
+        }
+
+        for (uint32_t k = 0, j = primary; k < out_size; k++) {
+            j = next[j];
+            out[k] = (uint8_t) j;
+            j >>= 8;
+        }
+    }
+
+    free(last);
+    free(next);
+    return ok;
+}
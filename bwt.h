@@ -0,0 +1,16 @@
+#ifndef __BWT_H__
+#define __BWT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BWT_MIN   1024 // smallest block worth sorting
+#define BWT_PROBE 65536 // bytes of a bigger block transformed first to see if the rest is worth it
+
+uint32_t bwt_transform(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t cap,
+    uint32_t *primary);
+
+bool bwt_inverse(
+    const uint8_t *in, uint32_t size, uint32_t primary, uint8_t *out, uint32_t out_size);
+
+#endif
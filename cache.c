@@ -0,0 +1,267 @@
+#include "cache.h"
+
+#include "code.h"
+#include "defines.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BYTE       8
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+#define PATH_SIZE  4096
+
+/* a table loaded from (or added to) the cache directory */
+typedef struct Entry {
+    uint64_t id; // hash of the tree dump
+    uint16_t tree_size;
+    uint8_t tree[MAX_TREE_SIZE];
+    PackedCode table[ALPHABET]; // codes (0 for symbols the tree does not have)
+    uint64_t sigs[2]; // fine and coarse signature known to name this table (no .sig read)
+    bool known[2]; // sigs[coarse] is set
+} Entry;
+
+/* tables on disk are named by id (<id>.tree, never rewritten) and found by signature
+ * (<signature>.sig holds the id of the latest table for it) */
+struct Cache {
+    char dir[PATH_SIZE];
+    Entry *entries; // recently used tables
+    uint32_t count; // entries in use
+    uint32_t next; // entry to replace when full
+};
+
+/* helper function for the 64-bit FNV-1a hash */
+static uint64_t fnv(const uint8_t *buf, uint64_t size) {
+    uint64_t h = FNV_OFFSET;
+    for (uint64_t i = 0; i < size; i++) {
+        h ^= buf[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/* constructor for a cache of tables kept in dir */
+Cache *cache_open(const char *dir) {
+    if (strlen(dir) + 32 >= PATH_SIZE || access(dir, X_OK) != 0)
+        return NULL;
+
+    Cache *c = (Cache *) calloc(1, sizeof(Cache));
+    if (c) {
+        strcpy(c->dir, dir);
+        c->entries = (Entry *) calloc(CACHE_ENTRIES, sizeof(Entry));
+        if (!c->entries) {
+            free(c);
+            c = NULL;
+        }
+    }
+    return c;
+}
+
+/* destructor for a cache */
+void cache_close(Cache **c) {
+    if (c && *c) {
+        free((*c)->entries);
+        free(*c);
+        *c = NULL;
+    }
+    return;
+}
+
+/* signature of a histogram: the rounded ideal code length of every symbol. histograms with
+ * the same signature are well served by the same table. a coarse signature only keeps which
+ * symbols are present; it finds a candidate when the fine one does not */
+uint64_t cache_signature(uint64_t hist[static ALPHABET], bool coarse) {
+    uint8_t q[ALPHABET] = { 0 };
+    uint64_t total = 0;
+
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        total += hist[i];
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        if (hist[i] > 0)
+            q[i] = coarse ? 1 : 1 + (uint8_t) lround(log2((double) total / hist[i])); // 0: absent
+
+    return fnv(q, ALPHABET) ^ coarse;
+}
+
+/* helper function to add a tree dump to the in memory entries */
+static Entry *remember(Cache *c, uint64_t id, uint8_t *tree, uint16_t tree_size) {
+    Node *root = rebuild_tree(tree_size, tree);
+    if (!root)
+        return NULL;
+
+    PackedCode table[ALPHABET]; // built aside so a rejected tree leaves the victim intact
+    uint32_t longest = build_packed(root, table);
+    delete_tree(&root);
+    if (longest > PACKED_MAX)
+        return NULL; // not from a block of at most MAX_SEGMENT bytes
+
+    Entry *e = &c->entries[c->next];
+    c->next = (c->next + 1) % CACHE_ENTRIES;
+    c->count += c->count < CACHE_ENTRIES;
+
+    e->id = id;
+    e->tree_size = tree_size;
+    memcpy(e->tree, tree, tree_size);
+    memcpy(e->table, table, sizeof(table));
+    e->known[0] = e->known[1] = false;
+    return e;
+}
+
+/* helper function to note that a signature names the table of an entry (and no other) */
+static void map_signature(Cache *c, Entry *e, uint64_t sig, int coarse) {
+    for (uint32_t i = 0; i < c->count; i++)
+        if (c->entries[i].known[coarse] && c->entries[i].sigs[coarse] == sig)
+            c->entries[i].known[coarse] = false;
+    e->sigs[coarse] = sig;
+    e->known[coarse] = true;
+    return;
+}
+
+/* helper function to get the entry a signature is known to name, without reading its file */
+static Entry *recall(Cache *c, uint64_t sig, int coarse) {
+    for (uint32_t i = 0; i < c->count; i++)
+        if (c->entries[i].known[coarse] && c->entries[i].sigs[coarse] == sig)
+            return &c->entries[i];
+    return NULL;
+}
+
+/* helper function to get the table with an id (from memory or from its file) */
+static Entry *lookup(Cache *c, uint64_t id) {
+    for (uint32_t i = 0; i < c->count; i++)
+        if (c->entries[i].id == id)
+            return &c->entries[i];
+
+    char path[PATH_SIZE + 32];
+    uint8_t tree[MAX_TREE_SIZE];
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 ".tree", c->dir, id);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    int size = read_bytes(fd, tree, MAX_TREE_SIZE);
+    close(fd);
+
+    /* the id is the hash of the dump. anything else is a damaged file */
+    if (size <= 0 || fnv(tree, size) != id)
+        return NULL;
+    return remember(c, id, tree, (uint16_t) size);
+}
+
+/* helper function to write a file in one go (to a temporary name, then renamed) */
+static bool store(const char *path, uint8_t *buf, uint16_t size) {
+    char temp[PATH_SIZE + 64];
+    snprintf(temp, sizeof(temp), "%s.%d", path, (int) getpid());
+
+    int fd = open(temp, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1)
+        return false;
+    bool ok = write_bytes(fd, buf, size) == size;
+    close(fd);
+
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        return false;
+    }
+    return true;
+}
+
+/* looks for a cached table good enough for hist. a table is reused if it has a code for every
+ * symbol in hist, its codes (plus the 8-byte id) cost at most CACHE_LOSS more than the
+ * entropy bound plus a fresh tree dump, and its codes take no more than the bytes they code
+ * (the room a block has for them). on success the codes are copied to table */
+bool cache_find(
+    Cache *c, uint64_t hist[static ALPHABET], uint64_t *id, PackedCode table[static ALPHABET]) {
+    char path[PATH_SIZE + 32];
+    Entry *e = NULL;
+
+    /* try the fine signature, then the coarse one. a signature seen before is not read again */
+    for (int coarse = 0; coarse < 2 && !e; coarse++) {
+        uint64_t found = 0, sig = cache_signature(hist, coarse);
+        if ((e = recall(c, sig, coarse)))
+            break;
+        snprintf(path, sizeof(path), "%s/%016" PRIx64 ".sig", c->dir, sig);
+
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+            continue;
+        int size = read_bytes(fd, (uint8_t *) &found, sizeof(found));
+        close(fd);
+
+        e = size == sizeof(found) ? lookup(c, found) : NULL;
+        if (e)
+            map_signature(c, e, sig, coarse);
+    }
+    if (!e)
+        return false;
+
+    uint64_t total = 0, unique = 0, bits = 0;
+    double cached = 8 * sizeof(uint64_t), fresh = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] == 0)
+            continue;
+        if (e->table[i] == 0 && e->tree_size > 2)
+            return false; // symbol missing from the cached tree
+        total += hist[i];
+        unique++;
+        cached += (double) hist[i] * packed_len(e->table[i]);
+        bits += hist[i] * packed_len(e->table[i]);
+    }
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        if (hist[i] > 0)
+            fresh += hist[i] * log2((double) total / hist[i]);
+    fresh += 8 * (3 * unique - 1);
+
+    /* a single leaf tree only codes its own symbol */
+    if (e->tree_size == 2 && (unique != 1 || hist[e->tree[1]] == 0))
+        return false;
+
+    if (cached > fresh * (1 + CACHE_LOSS) || bits > total * BYTE)
+        return false;
+
+    memcpy(table, e->table, ALPHABET * sizeof(PackedCode));
+    *id = e->id;
+    return true;
+}
+
+/* adds a table (as a tree dump) for hist to the cache and makes it the one found for the
+ * signatures of hist. returns the id of the table */
+uint64_t cache_add(Cache *c, uint64_t hist[static ALPHABET], uint8_t *tree, uint16_t tree_size) {
+    uint64_t id = fnv(tree, tree_size);
+    char path[PATH_SIZE + 32];
+
+    /* trees are named by their hash so an existing file never changes */
+    snprintf(path, sizeof(path), "%s/%016" PRIx64 ".tree", c->dir, id);
+    if (access(path, F_OK) != 0)
+        store(path, tree, tree_size);
+
+    /* kept in memory, found by its signatures from now on */
+    Entry *e = NULL;
+    for (uint32_t i = 0; i < c->count && !e; i++)
+        e = c->entries[i].id == id ? &c->entries[i] : NULL;
+    e = e ? e : remember(c, id, tree, tree_size);
+    for (int coarse = 0; coarse < 2; coarse++) {
+        uint64_t sig = cache_signature(hist, coarse);
+        snprintf(path, sizeof(path), "%s/%016" PRIx64 ".sig", c->dir, sig);
+        store(path, (uint8_t *) &id, sizeof(id));
+        if (e)
+            map_signature(c, e, sig, coarse);
+    }
+
+    return id;
+}
+
+/* rebuilds the tree of the table with an id. returns NULL if the cache does not have it */
+Node *cache_tree(Cache *c, uint64_t id) {
+    Entry *e = c ? lookup(c, id) : NULL;
+    return e ? rebuild_tree(e->tree_size, e->tree) : NULL;
+}
@@ -0,0 +1,29 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "code.h"
+#include "defines.h"
+#include "node.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CACHE_ENTRIES 64 // tables kept in memory
+#define CACHE_LOSS    0.01 // a cached table may cost up to 1% more than a fresh one
+
+typedef struct Cache Cache;
+
+Cache *cache_open(const char *dir);
+
+void cache_close(Cache **c);
+
+uint64_t cache_signature(uint64_t hist[static ALPHABET], bool coarse);
+
+bool cache_find(
+    Cache *c, uint64_t hist[static ALPHABET], uint64_t *id, PackedCode table[static ALPHABET]);
+
+uint64_t cache_add(Cache *c, uint64_t hist[static ALPHABET], uint8_t *tree, uint16_t tree_size);
+
+Node *cache_tree(Cache *c, uint64_t id);
+
+#endif
@@ -0,0 +1,76 @@
+#!/bin/bash
+# round trip checks of encode and decode (make check). exits non zero if one fails
+
+set -o pipefail
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+# prints the first 4 bytes of a file (the magic number, little endian) as hex
+magic() {
+    od -A n -t x4 -N 4 "$1" | tr -d ' '
+}
+
+# reports a check: name and whether the command before it succeeded
+check() {
+    if [ "$1" -eq 0 ]; then
+        echo "ok   $2"
+    else
+        echo "FAIL $2"
+        fail=1
+    fi
+}
+
+# a skewed file (byte 0 at ~95%) and some text
+head -c 2000000 /dev/urandom | tr '\000-\365' '\000' > "$dir/skew.bin"
+for i in $(seq 1 20000); do echo "line $i: the quick brown fox $((i % 7))"; done > "$dir/log.txt"
+printf 'x' > "$dir/one.bin"
+
+# plain and threaded encodes keep the legacy format, and -j writes the same bytes
+./encode -i "$dir/skew.bin" -o "$dir/skew.h" && [ "$(magic "$dir/skew.h")" = deadbeef ]
+check $? "plain encode of a skewed file is legacy"
+./encode -j 4 -i "$dir/skew.bin" -o "$dir/skew4.h" && cmp -s "$dir/skew.h" "$dir/skew4.h"
+check $? "-j 4 encode of a skewed file matches the plain one"
+./decode -i "$dir/skew4.h" -o "$dir/skew.out" && cmp -s "$dir/skew.bin" "$dir/skew.out"
+check $? "skewed file round trip"
+./encode -b -i "$dir/skew.bin" -o "$dir/skewb.h" && [ "$(magic "$dir/skewb.h")" = deadb10c ] \
+    && ./decode -i "$dir/skewb.h" | cmp -s "$dir/skew.bin" -
+check $? "-b encode of a skewed file is a block stream"
+
+# appending to a streamed file (twice: the second append rewrites the index of the first)
+./encode -s 100000 < "$dir/log.txt" > "$dir/st.h" && ./encode -a -i "$dir/one.bin" -o "$dir/st.h" \
+    && ./encode -a -i "$dir/log.txt" -o "$dir/st.h" \
+    && ./decode -i "$dir/st.h" | cmp -s - <(cat "$dir/log.txt" "$dir/one.bin" "$dir/log.txt")
+check $? "append after a stream"
+
+# a stream takes the mode of its input, as a whole-file encode does
+chmod 640 "$dir/log.txt"
+./encode -s 100000 -i "$dir/log.txt" -o "$dir/mode.h" && [ "$(stat -c %a "$dir/mode.h")" = 640 ]
+check $? "stream output keeps the input mode"
+
+# a one leaf file decodes its header's size from no codes, so a corrupt size is capped (-r)
+printf '\xef\xbe\xad\xde\xa4\x81\x02\x00\x00\x00\x00\x00\x00\x00\x00\x40La' > "$dir/leaf.h"
+timeout 10 ./decode -i "$dir/leaf.h" -o /dev/null 2> /dev/null
+e=$?
+[ $e -ne 0 ] && [ $e -ne 124 ] # refused, not cut off by the timeout
+check $? "one leaf file with a corrupt size is refused"
+printf '\xef\xbe\xad\xde\xa4\x81\x02\x00\x88\x13\x00\x00\x00\x00\x00\x00La' > "$dir/leaf.h"
+./decode -i "$dir/leaf.h" | cmp -s - <(head -c 5000 /dev/zero | tr '\0' a) \
+    && ! ./decode -r 4999 -i "$dir/leaf.h" -o /dev/null 2> /dev/null
+check $? "one leaf file decodes up to the -r cap"
+
+# a cached table must not be reused where its codes would take more than a byte a symbol:
+# a mildly skewed file caches a table that all-256-symbol random data also matches
+mkdir "$dir/cache"
+for i in $(seq 1 15); do
+    head -c 61440 /dev/urandom
+    head -c 300000 /dev/urandom | tr -dc '\000-\007' | head -c 4096
+done > "$dir/mild.bin"
+head -c 1048576 /dev/urandom > "$dir/rnd.bin"
+./encode -e huffman -c "$dir/cache" -i "$dir/mild.bin" -o "$dir/mild.h" \
+    && ./encode -e huffman -c "$dir/cache" -i "$dir/rnd.bin" -o "$dir/rnd.h" \
+    && [ "$(stat -c %s "$dir/rnd.h")" -le $((1048576 + 2048)) ] \
+    && ./decode -c "$dir/cache" -i "$dir/rnd.h" | cmp -s "$dir/rnd.bin" -
+check $? "cached table too long for random data is not reused"
+
+exit $fail
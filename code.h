@@ -11,6 +11,21 @@ typedef struct Code {
     uint8_t bits[MAX_CODE_SIZE];
 } Code;
 
+#define PACKED_LEN 6 // low bits of a PackedCode that hold the code length
+#define PACKED_MAX 57 // longest code a PackedCode holds (64 - PACKED_LEN - 1)
+
+/* a whole code in one register: the code bits (first bit lowest) above its length.
+ * 0 for a symbol without a code (or a code longer than PACKED_MAX) */
+typedef uint64_t PackedCode;
+
+static inline uint32_t packed_len(PackedCode p) {
+    return (uint32_t) (p & ((1 << PACKED_LEN) - 1));
+}
+
+static inline uint64_t packed_bits(PackedCode p) {
+    return p >> PACKED_LEN;
+}
+
 Code code_init(void);
 
 uint32_t code_size(Code *c);
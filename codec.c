@@ -0,0 +1,218 @@
+#include "codec.h"
+
+#include "block.h"
+#include "cache.h"
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+#include "kernels.h"
+#include "node.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE 8
+
+/* in memory encoder/decoder. the output buffer is kept (and only grows) between calls so a
+ * long running caller does not go back to the allocator for every buffer, and so are the last
+ * tables: a payload like the one before it skips building its tree and codes (compress), and a
+ * stream with the same tree dump skips rebuilding its tree and decode table (decompress) */
+struct Codec {
+    uint8_t *out; // output of the last call
+    uint64_t cap; // room in out
+    bool coded; // the codes below are from an earlier compress
+    uint64_t sig; // cache_signature of the histogram they were built for
+    uint16_t tree_size;
+    uint8_t tree[MAX_TREE_SIZE]; // dump of their tree
+    PackedCode codes[ALPHABET];
+    uint16_t dump_size;
+    uint8_t dump[MAX_TREE_SIZE]; // tree dump of the last single stream decompressed
+    Node *root; // its tree (NULL if none)
+    DecodeTable *table; // and decode table
+};
+
+/* constructor for a codec */
+Codec *codec_create(void) {
+    return (Codec *) calloc(1, sizeof(Codec));
+}
+
+/* helper function to drop the decode tables kept by a codec */
+static void forget_tables(Codec *c) {
+    table_delete(&c->table);
+    if (c->root)
+        delete_tree(&c->root);
+    c->dump_size = 0;
+    return;
+}
+
+/* destructor for a codec */
+void codec_delete(Codec **c) {
+    if (c && *c) {
+        forget_tables(*c);
+        free((*c)->out);
+        free(*c);
+        *c = NULL;
+    }
+    return;
+}
+
+/* helper function to make room for size bytes (plus table slack, which is also enough for the
+ * whole words emit stores) in the output */
+static bool reserve(Codec *c, uint64_t size) {
+    if (size + TABLE_SLACK > c->cap) {
+        uint8_t *grown = (uint8_t *) realloc(c->out, size + TABLE_SLACK);
+        if (!grown)
+            return false;
+        c->out = grown;
+        c->cap = size + TABLE_SLACK;
+    }
+    return true;
+}
+
+/* compresses size bytes of in to the same format encode writes. *out points to the result
+ * (owned by the codec, valid till the next call). returns its size or -1 on error */
+int64_t codec_compress(
+    Codec *c, const uint8_t *in, uint64_t size, uint16_t permissions, uint8_t **out) {
+    if (size > CODEC_MAX)
+        return -1;
+
+    /* histogram (symbols 0 and 255 always present, like encode, unless one byte repeats) */
+    uint64_t hist[ALPHABET] = { 0 };
+    uint16_t unique_sym = 0;
+    kernels->histogram(in, size, hist);
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        unique_sym += hist[i] > 0;
+    if (unique_sym > 1) {
+        unique_sym += (hist[0] == 0) + (hist[255] == 0);
+        hist[0]++;
+        hist[255]++;
+    } else if (unique_sym == 0) {
+        hist[0] = 1; // a one leaf tree for no input
+        unique_sym = 1;
+    }
+
+    /* the codes of the last payload serve one with the same signature (same symbols, code
+     * lengths that differ by less than a bit from the ideal ones). others build their own */
+    uint64_t sig = cache_signature(hist, false);
+    if (!c->coded || c->sig != sig) {
+        Node *root = build_tree(hist);
+        if (!root)
+            return -1;
+        build_packed(root, c->codes); // at most CODEC_MAX bytes: every code packs
+        c->tree_size = (uint16_t) (3 * unique_sym - 1);
+        dump_tree(root, c->tree);
+        delete_tree(&root);
+        c->sig = sig;
+        c->coded = true;
+    }
+    PackedCode *table = c->codes;
+
+    /* exact size of the codes (the two padding symbols are not coded) */
+    uint64_t bits = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        bits += hist[i] * packed_len(table[i]);
+    bits -= packed_len(table[0]) + packed_len(table[ALPHABET - 1]);
+
+    Header h = { .magic = MAGIC,
+        .permissions = permissions,
+        .tree_size = c->tree_size,
+        .file_size = size };
+    uint64_t comp_fz = sizeof(Header) + h.tree_size + (bits + BYTE - 1) / BYTE;
+
+    if (!reserve(c, comp_fz))
+        return -1;
+
+    memcpy(c->out, &h, sizeof(Header));
+    memcpy(c->out + sizeof(Header), c->tree, h.tree_size);
+
+    /* append the codes (lsb first, like write_code) */
+    uint8_t *dst = c->out + sizeof(Header) + h.tree_size;
+    uint64_t acc = 0;
+    uint32_t nacc = 0;
+    dst += kernels->emit(table, in, size, dst, &acc, &nacc);
+    if (nacc > 0)
+        *dst = (uint8_t) acc;
+
+    *out = c->out;
+    return (int64_t) comp_fz;
+}
+
+/* decompresses size bytes of in (a single stream, or block streams one after another). in needs
+ * TABLE_SLACK readable bytes past its end. *out points to the result (owned by the codec, valid
+ * till the next call). returns its size or -1 on error */
+int64_t codec_decompress(Codec *c, const uint8_t *in, uint64_t size, uint8_t **out) {
+    Header h;
+
+    if (size < sizeof(Header))
+        return -1;
+    memcpy(&h, in, sizeof(Header));
+    if ((h.magic != MAGIC && h.magic != BLOCK_MAGIC) || h.file_size > CODEC_MAX
+        || h.tree_size > MAX_TREE_SIZE || !reserve(c, h.file_size))
+        return -1;
+
+    uint64_t at = sizeof(Header), tot_decoded = 0, want = h.file_size;
+
+    /* single stream: one tree, then codes up to the end of in */
+    if (h.magic == MAGIC) {
+        if (at + h.tree_size > size)
+            return -1;
+
+        /* the tables of the last stream serve one with the same tree dump */
+        if (!c->table || c->dump_size != h.tree_size
+            || memcmp(c->dump, in + at, h.tree_size) != 0) {
+            forget_tables(c);
+            c->root = rebuild_tree(h.tree_size, (uint8_t *) in + at);
+            c->table = table_create(c->root);
+            if (!c->table) {
+                forget_tables(c);
+                return -1;
+            }
+            c->dump_size = h.tree_size;
+            memcpy(c->dump, in + at, h.tree_size);
+        }
+
+        uint64_t pos = 0;
+        at += h.tree_size;
+        tot_decoded
+            = table_decode(c->table, in + at, (size - at) * BYTE, &pos, c->out, h.file_size);
+    }
+
+    /* block stream: every block is decoded in place. concatenated streams follow each other */
+    while (h.magic == BLOCK_MAGIC && at + sizeof(BlockHeader) <= size) {
+        BlockHeader bh;
+        memcpy(&bh, in + at, sizeof(BlockHeader));
+        at += sizeof(BlockHeader);
+
+        if (bh.type == BLOCK_END) {
+            if (at == size || tot_decoded != want)
+                break;
+            if (at + sizeof(Header) > size)
+                return -1;
+            memcpy(&h, in + at, sizeof(Header));
+            at += sizeof(Header);
+            if (h.magic != BLOCK_MAGIC || want + h.file_size > CODEC_MAX
+                || !reserve(c, want + h.file_size))
+                return -1;
+            want += h.file_size;
+            continue;
+        }
+
+        uint64_t body_size = block_body_size(&bh);
+        if (!block_valid(&bh) || at + body_size > size || tot_decoded + bh.size > want
+            || !block_decode_body(&bh, (uint8_t *) in + at, c->out + tot_decoded, NULL))
+            return -1;
+
+        at += body_size;
+        tot_decoded += bh.size;
+    }
+
+    if (tot_decoded != want)
+        return -1; // truncated or corrupt
+
+    *out = c->out;
+    return (int64_t) tot_decoded;
+}
@@ -0,0 +1,19 @@
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+#include <stdint.h>
+
+#define CODEC_MAX (256 * 1024 * 1024) // largest buffer the in memory codec works on
+
+typedef struct Codec Codec;
+
+Codec *codec_create(void);
+
+void codec_delete(Codec **c);
+
+int64_t codec_compress(
+    Codec *c, const uint8_t *in, uint64_t size, uint16_t permissions, uint8_t **out);
+
+int64_t codec_decompress(Codec *c, const uint8_t *in, uint64_t size, uint8_t **out);
+
+#endif
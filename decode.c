@@ -1,20 +1,33 @@
+#include "block.h"
+#include "cache.h"
 #include "code.h"
 #include "header.h"
 #include "huffman.h"
 #include "io.h"
+#include "kernels.h"
 #include "node.h"
+#include "parallel.h"
 #include "pq.h"
+#include "prof.h"
 #include "stack.h"
+#include "table.h"
 
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
-#define BYTE 8
+#define BYTE   8
+#define WINDOW (16 * BLOCK) // 64KB of codes read in at a time
+#define FILL   ((uint64_t) 1 << 32) // most bytes a one leaf file may claim unless -r raises it
+
+/* hardware counters of each phase (NULL unless measuring) */
+static Prof *prof = NULL;
 
 /* helper function to print usage (credits: idea from error c file in lab5) */
 static void usage(char *argv) {
@@ -24,11 +37,22 @@ static void usage(char *argv) {
         "  Decompresses a file using the Huffman coding algorithm.\n"
         "\n"
         "USAGE\n"
-        "  ./%s [-h] [-i infile] [-o outfile]\n"
+        "  ./%s [-h] [-v] [-m] [-d] [-z] [-c dir] [-j threads] [-k level] [-r bytes]\n"
+        "     [-i infile] [-o outfile]\n"
         "\n"
         "OPTIONS\n"
         "  -h             Program usage and help.\n"
         "  -v             Print compression statistics.\n"
+        "  -m             Measure each phase with hardware counters (cycles, instructions,\n"
+        "                 branch and cache misses) and print cycles per byte.\n"
+        "  -d             Direct I/O: keep the files out of the page cache (bulk archival).\n"
+        "  -z             Zero copy output to a pipe (vmsplice). The reader must read the\n"
+        "                 pipe, not splice or tee it on.\n"
+        "  -c dir         Directory of cached tables the input refers to.\n"
+        "  -j threads     Decode with threads threads starting at guessed offsets.\n"
+        "  -k level       Force the kernels: scalar, sse4.2 or bmi2 (default: best).\n"
+        "  -r bytes       Most bytes a file of one repeated byte (whose size is only its\n"
+        "                 header's word) may decode to (default: 4GB).\n"
         "  -i infile      Input file to decompress.\n"
         "  -o outfile     Output of decompressed data.\n",
         argv);
@@ -36,24 +60,53 @@ static void usage(char *argv) {
     return;
 }
 
-/* helper function to close files open in main */
+/* helper function to size outfile to size bytes up front if it is a regular file written from
+ * its start (one allocation instead of a page at a time). sizes past bound (what the input can
+ * honestly claim), or that cannot be allocated (a full disk), are not trusted: the file is only
+ * emptied, so writes report the error instead of a mapping faulting. returns false for those
+ * and for other outputs (pipes, terminals, appends), which are left alone */
+static bool reserve_output(int outfile, uint64_t size, uint64_t bound) {
+    struct stat st;
+    int flags = fcntl(outfile, F_GETFL);
+    if (flags == -1 || (flags & O_APPEND) || fstat(outfile, &st) != 0 || !S_ISREG(st.st_mode)
+        || lseek(outfile, 0, SEEK_CUR) != 0)
+        return false;
+
+    bool reserved = size <= bound && (size == 0 || posix_fallocate(outfile, 0, (off_t) size) == 0);
+    bool sized = ftruncate(outfile, reserved ? (off_t) size : 0) == 0; // drops an old tail
+    return sized && reserved;
+}
+
+/* helper function to map the size bytes of outfile (sized by reserve_output and open for reading
+ * and writing) so symbols are decoded straight into the file. returns NULL if it cannot be */
+static uint8_t *map_output(int outfile, uint64_t size, uint64_t bound) {
+    if ((fcntl(outfile, F_GETFL) & O_ACCMODE) != O_RDWR || !reserve_output(outfile, size, bound))
+        return NULL;
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, outfile, 0);
+    return map == MAP_FAILED ? NULL : (uint8_t *) map;
+}
+
+/* helper function to close files open in main (writing out what is staged for them) */
 static void main_err(int in, int out) {
+    io_finish(in);
+    io_finish(out);
     close(in);
     close(out);
+    prof_delete(&prof);
     return;
 }
 
-/* helper function to determine if a node is leaf or not */
-static bool is_leaf(Node *n) {
-    if (n)
-        return (!n->left && !n->right); // no child nodes then true, else false
-    return false;
-}
-
 int main(int argc, char **argv) {
     int c;
-    char *optlist = "hvi:o:";
+    char *optlist = "hvmdzc:j:k:r:i:o:";
     uint8_t verbose = 0; // no set since only one arg checked/added
+    uint32_t threads = 1; // threads decoding codes
+    Cache *cache = NULL; // tables shared between files
+    const char *level = NULL; // kernel level to force
+    bool direct = false; // read and write around the page cache
+    bool measure = false; // profile the phases
+    bool zero_copy = false; // hand output pages to a pipe
+    uint64_t fill = FILL; // most bytes a one leaf tree is trusted to decode to
 
     /* default file values */
     int infile = STDIN_FILENO;
@@ -73,8 +126,9 @@ int main(int argc, char **argv) {
             break;
 
         case 'o':
-            outfile = open(optarg,
-                O_CREAT | O_WRONLY); // open write only (create if not present) and handle err
+            outfile = open(optarg, O_CREAT | O_RDWR); // read write to map it (create if absent)
+            if (outfile == -1)
+                outfile = open(optarg, O_CREAT | O_WRONLY); // write only. decoded through a buffer
             if (outfile == -1) {
                 fprintf(stderr, "Error: Cannot open output file.\n");
                 main_err(infile, -1);
@@ -84,10 +138,60 @@ int main(int argc, char **argv) {
 
         case 'v': verbose = 1; break;
 
+        case 'd': direct = true; break;
+
+        case 'm': measure = true; break;
+
+        case 'z': zero_copy = true; break;
+
+        case 'c':
+            cache = cache_open(optarg);
+            if (!cache) {
+                fprintf(stderr, "Error: Cannot use cache directory.\n");
+                main_err(infile, outfile);
+                return -1;
+            }
+            break;
+
+        case 'j':
+            threads = (uint32_t) strtoul(optarg, NULL, 10);
+            if (threads == 0 || threads > MAX_THREADS) {
+                fprintf(stderr, "Error: Threads must be between 1 and %d.\n", MAX_THREADS);
+                main_err(infile, outfile);
+                return -1;
+            }
+            break;
+
+        case 'k': level = optarg; break;
+
+        case 'r': fill = strtoull(optarg, NULL, 10); break;
+
         default: usage(argv[0]); return -1;
         }
     }
 
+    /* pick the hot loops for this cpu */
+    if (!kernels_init(level)) {
+        fprintf(stderr, "Error: Unknown or unsupported kernel level.\n");
+        main_err(infile, outfile);
+        cache_close(&cache);
+        return -1;
+    }
+
+    /* counters are opened before the input is touched (a profile is left out if out of memory) */
+    if (measure)
+        prof = prof_create();
+
+    /* bulk jobs keep their data out of the page cache (regular files only) */
+    if (direct) {
+        io_direct(infile, false);
+        io_direct(outfile, true);
+    }
+
+    /* output to a pipe is queued by reference instead of copied (pipes only) */
+    if (zero_copy)
+        io_splice(outfile);
+
     /* CREDITS: Modified version (for err handling) of the code snippet in the lab documentation */
     /* file permission setting */
     struct stat statbuf;
@@ -107,7 +211,7 @@ int main(int argc, char **argv) {
         sizeof(Header)); // read in header and update compressed file size by it
 
     /* different magic number */
-    if (h.magic != MAGIC) {
+    if (h.magic != MAGIC && h.magic != BLOCK_MAGIC) {
         fprintf(stderr, "Magic number does not match.\n");
         main_err(infile, outfile);
         return -1;
@@ -127,67 +231,181 @@ int main(int argc, char **argv) {
         return -1;
     }
 
+    /* a code is at least a bit, so a regular input decodes to at most 8 bytes per byte (more
+     * only for inputs like single symbol trees, which are not sized up front) */
+    uint64_t bound = S_ISREG(statbuf.st_mode) ? (uint64_t) statbuf.st_size * BYTE : 0;
+
+    /* block stream. each block carries its own tree (and is written whole) */
+    if (h.magic == BLOCK_MAGIC) {
+        reserve_output(outfile, h.file_size, bound); // later concatenated streams grow it
+        int64_t tot_decoded = 0;
+        uint32_t streams = 0; // concatenated streams decoded
+        prof_begin(prof);
+
+        /* streams compressed apart (shards) and concatenated decode one after another */
+        while (true) {
+            int64_t n
+                = h.magic == BLOCK_MAGIC ? block_decode(infile, outfile, &comp_fz, cache) : -1;
+            if (n < 0 || (h.file_size != STREAM_SIZE && (uint64_t) n != h.file_size)) {
+                tot_decoded = -1;
+                break;
+            }
+            tot_decoded += n;
+            streams++;
+
+            /* the header of the next stream, if any */
+            int got = read_bytes(infile, (uint8_t *) &h, sizeof(Header));
+            comp_fz += (uint64_t) got;
+            if (got == 0)
+                break;
+            if (got != sizeof(Header)) {
+                tot_decoded = -1;
+                break;
+            }
+        }
+        prof_end(prof, "blocks");
+        cache_close(&cache);
+        if (tot_decoded < 0) {
+            fprintf(stderr, "Corrupt or truncated block stream (or missing cached table, or the "
+                            "output could not be written).\n");
+            main_err(infile, outfile);
+            return -1;
+        }
+
+        if (verbose) {
+            fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp_fz);
+            fprintf(stderr, "Deompressed file size: %" PRId64 " bytes\n", tot_decoded);
+            if (streams > 1)
+                fprintf(stderr, "Streams: %" PRIu32 "\n", streams);
+            fprintf(stderr, "Space saving: %0.2lf%%\n",
+                100 * (1 - ((double) comp_fz / tot_decoded)));
+            fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
+        }
+        prof_report(prof, comp_fz, (uint64_t) tot_decoded);
+
+        main_err(infile, outfile);
+        return 0;
+    }
+
     /* rebuild the huffman tree */
+    prof_begin(prof);
     uint16_t tree_size = h.tree_size;
     uint8_t *tree_dump = (uint8_t *) calloc(
         tree_size, sizeof(uint8_t)); // buffer to store tree dump (to use write bytes later)
 
     /* read in the dumped tree and increase compressed file size*/
-    comp_fz += (uint64_t) read_bytes(infile, tree_dump, tree_size);
+    int got_tree = tree_dump ? read_bytes(infile, tree_dump, tree_size) : 0;
+    comp_fz += (uint64_t) got_tree;
 
-    Node *root = rebuild_tree(tree_size, tree_dump);
+    /* the dump is checked once here, so the decode loop does not check codes */
+    Node *root = got_tree == tree_size ? rebuild_tree(tree_size, tree_dump) : NULL;
     free(tree_dump);
     tree_dump = NULL; // done with tree
+    if (!root) {
+        prof_end(prof, "tree");
+        fprintf(stderr, "Corrupt or truncated tree dump.\n");
+        main_err(infile, outfile);
+        cache_close(&cache);
+        return -1;
+    }
+
+    /* a one leaf tree decodes file_size bytes from no codes at all, so a corrupt (or hostile)
+     * header could have it write without end. its size is only trusted up to fill */
+    if (!root->left && h.file_size > fill) {
+        prof_end(prof, "tree");
+        fprintf(stderr, "Implausible size for a file of one repeated byte (see -r).\n");
+        main_err(infile, outfile);
+        delete_tree(&root);
+        cache_close(&cache);
+        return -1;
+    }
 
-    /* decompress */
-    uint8_t *buffer = (uint8_t *) calloc(BLOCK, sizeof(uint8_t)); // buffer to hold read in bytes
-    uint16_t at = 0; // index in buffer
-    uint8_t bit_val; // read in bit val
+    /* decompress. codes are read a window at a time and decoded with a lookup table */
+    DecodeTable *table = table_create(root);
+    uint8_t *window = (uint8_t *) calloc(WINDOW + TABLE_SLACK, sizeof(uint8_t)); // read in codes
+    uint8_t *buffer = (uint8_t *) calloc(BLOCK, sizeof(uint8_t)); // buffer to hold symbols
+    uint64_t have = 0; // bytes in window
+    uint64_t at = 0; // bit index in window
+    bool eof = false; // infile has no more codes
     uint64_t tot_decoded = 0; // decompressed file size
-    Node *temp = root; // for traversing the tree
     uint64_t temp_comp_fz = 0; // tracks totals bits read (to get total bytes read later)
+    prof_end(prof, "tree");
 
-    /* parse the tree, buffer symbols, and write them out */
-    while (tot_decoded < h.file_size) {
+    prof_begin(prof);
 
-        if (read_bit(infile, &bit_val))
-            temp_comp_fz++; // total bits read++ if true
+    /* speculative decoders at guessed offsets, lined up once they are done */
+    bool parallel = threads > 1 && table && root->left; // a one leaf tree has no codes to split
+    bool written = true; // false once a write falls short (a full disk)
+    if (parallel) {
+        int64_t n = parallel_decode(infile, outfile, table, h.file_size, threads, &temp_comp_fz);
+        written = n >= 0;
+        tot_decoded = written ? (uint64_t) n : 0;
+    }
 
-        /* reached leaf */
-        if (is_leaf(temp)) {
-            buffer[at] = temp->symbol; // store the symbol
-            temp = root; // reinitialize
-            tot_decoded++; // decompressed file size++
-            at++; // index incremented
+    /* a regular output file is sized once and decoded into in place. others get a buffer of
+     * symbols at a time */
+    bool mapped = !parallel && table && !direct; // direct output stays out of the cache
+    uint8_t *map = mapped ? map_output(outfile, h.file_size, bound) : NULL;
+    while (!parallel && table && window && buffer && written && tot_decoded < h.file_size) {
+        uint64_t want = h.file_size - tot_decoded;
+        want = !map && want > BLOCK ? BLOCK : want;
+        uint64_t start = at;
+        uint8_t *spliced = map ? NULL : io_window(outfile, (uint32_t) want); // NULL unless -z
+        uint8_t *dst = map ? map + tot_decoded : spliced ? spliced : buffer;
+        uint64_t got = table_decode(table, window, have * BYTE, &at, dst, want);
+        temp_comp_fz += at - start;
+
+        if (got > 0) {
+            if (spliced)
+                io_commit(outfile, (uint32_t) got);
+            else if (!map)
+                written = (uint64_t) write_bytes(outfile, buffer, (int) got) == got;
+            tot_decoded += got;
+            continue;
         }
 
-        /* buffer full. write out codes */
-        if (at == BLOCK) {
-            write_bytes(outfile, buffer, at);
-            at = 0; // reset the index
-        }
+        /* no complete code left in the window and nothing more to read */
+        if (eof)
+            break;
 
-        /* keep traversing */
-        if (bit_val)
-            temp = temp->right; // bit = 1 go down right, else left
-        else
-            temp = temp->left;
+        /* slide the unread bytes to the front and refill the window */
+        uint64_t keep = have - at / BYTE;
+        memmove(window, window + at / BYTE, keep);
+        at %= BYTE;
+        int tot_read = read_bytes(infile, window + keep, WINDOW - keep);
+        have = keep + tot_read;
+        eof = (uint64_t) tot_read < WINDOW - keep; // read_bytes only stops short at EOF
+        memset(window + have, 0, TABLE_SLACK);
     }
 
-    /* flush the remaining ones */
-    if (at != 0)
-        write_bytes(outfile, buffer, at);
-
+    if (map)
+        munmap(map, h.file_size);
+    table_delete(&table);
+    free(window);
+    window = NULL;
     free(buffer);
     buffer = NULL; // done with the buffer
+    prof_end(prof, "codes");
 
-    /* print statistics */
-    if (verbose) {
+    if (!written) {
+        fprintf(stderr, "Failed to write the output file.\n");
+        main_err(infile, outfile);
+        delete_tree(&root);
+        return -1;
+    }
+    if (tot_decoded < h.file_size) {
+        fprintf(stderr, "Corrupt or truncated input.\n");
+        main_err(infile, outfile);
+        delete_tree(&root);
+        return -1;
+    }
 
-        /* compressed file size = minimum bytes for total bits read in + total bytes read in */
-        temp_comp_fz = temp_comp_fz / BYTE == 0 ? 1 : temp_comp_fz / BYTE + 1;
-        comp_fz += temp_comp_fz;
+    /* compressed file size = minimum bytes for total bits read in + total bytes read in */
+    temp_comp_fz = temp_comp_fz / BYTE == 0 ? 1 : temp_comp_fz / BYTE + 1;
+    comp_fz += temp_comp_fz;
 
+    /* print statistics */
+    if (verbose) {
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp_fz);
         fprintf(stderr, "Deompressed file size: %" PRIu64 " bytes\n", tot_decoded);
 
@@ -197,10 +415,13 @@ int main(int argc, char **argv) {
                     - (((double) comp_fz)
                         / tot_decoded))); // formula credit: provided in the lab documentation
         fprintf(stderr, "Space saving: %0.2lf%%\n", space_save);
+        fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
     }
+    prof_report(prof, comp_fz, tot_decoded);
 
     /* free mem, close files */
     main_err(infile, outfile);
     delete_tree(&root);
+    cache_close(&cache);
     return 0;
 }
@@ -4,7 +4,11 @@
 #define BLOCK         4096 // 4KB blocks.
 #define ALPHABET      256 // ASCII + Extended ASCII.
 #define MAGIC         0xDEADBEEF // 32-bit magic number.
+#define BLOCK_MAGIC   0xDEADB10C // 32-bit magic number for block streams.
+#define ARCHIVE_MAGIC 0xDEADA4C5 // 32-bit magic number at the end of archives.
 #define MAX_CODE_SIZE (ALPHABET / 8) // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
+#define CHUNK         (8 * BLOCK) // 32KB chunks analysed when splitting blocks.
+#define MAX_SEGMENT   (256 * BLOCK) // 1MB cap on the data coded by one block.
 
 #endif
@@ -1,16 +1,24 @@
+#include "block.h"
+#include "cache.h"
 #include "code.h"
 #include "header.h"
 #include "huffman.h"
 #include "io.h"
+#include "kernels.h"
 #include "node.h"
+#include "parallel.h"
 #include "pq.h"
+#include "prof.h"
+#include "split.h"
 #include "stack.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -22,6 +30,9 @@
 /* to keep track of unique elements (used for tree size) */
 static uint16_t unique_sym = 2; // 2 since elem 0 and 255 are always incremented
 
+/* hardware counters of each phase (NULL unless measuring) */
+static Prof *prof = NULL;
+
 /* helper function to print usage (credits: idea from error c file in lab5) */
 static void usage(char *argv) {
     fprintf(stderr,
@@ -30,11 +41,33 @@ static void usage(char *argv) {
         "  Compresses a file using the Huffman coding algorithm.\n"
         "\n"
         "USAGE\n"
-        "  ./%s [-h] [-i infile] [-o outfile]\n"
+        "  ./%s [-h] [-v] [-m] [-d] [-b] [-a] [-c dir] [-w width] [-p width] [-t transform]\n"
+        "     [-e backend] [-s bytes] [-l ms] [-j threads] [-k level] [-i infile] [-o outfile]\n"
         "\n"
         "OPTIONS\n"
         "  -h             Program usage and help.\n"
         "  -v             Print compression statistics.\n"
+        "  -m             Measure each phase with hardware counters (cycles, instructions,\n"
+        "                 branch and cache misses) and print cycles per byte.\n"
+        "  -d             Direct I/O: keep the files out of the page cache (bulk archival).\n"
+        "  -b             Split input into blocks with their own trees.\n"
+        "  -a             Append to the block stream in outfile (needs -o) without recoding\n"
+        "                 what it holds. Implies -b.\n"
+        "  -c dir         Reuse (and add) tables cached in dir. Implies -b.\n"
+        "  -w width       Also try symbols of width bytes (2 or 4) per block. Implies -b.\n"
+        "  -p width       Also try splitting elements of width bytes (2 to 16) into byte planes\n"
+        "                 coded with separate tables. Implies -b.\n"
+        "  -t transform   Also try a transform of each block: bwt (burrows-wheeler, for text)\n"
+        "                 or words (a vocabulary of words and separators, for logs). Can be\n"
+        "                 given twice. Implies -b.\n"
+        "  -e backend     Entropy coder: huffman, ans or auto (default: ans for the blocks where\n"
+        "                 it saves over 2%%). ans and auto need -b (ans implies it).\n"
+        "  -s bytes       Stream: code the input as it comes in, flushing a block and a sync\n"
+        "                 marker every bytes bytes (up to 1MB) and at the end. Implies -b.\n"
+        "  -l ms          Stream, also flushing what came in ms milliseconds ago (default with\n"
+        "                 -s: no timer, without it: flush every 1MB). Implies -b.\n"
+        "  -j threads     Write codes with threads threads (same output).\n"
+        "  -k level       Force the kernels: scalar, sse4.2 or bmi2 (default: best).\n"
         "  -i infile      Input file to compress.\n"
         "  -o outfile     Output of compressed data.\n",
         argv);
@@ -42,12 +75,38 @@ static void usage(char *argv) {
     return;
 }
 
-/* helper function to close files open in main */
-static void main_err(int in, int out, int temp_fd) {
+/* helper function to close files open in main (writing out what is staged for them).
+ * returns false if what was staged for out could not be written */
+static bool main_err(int in, int out, int temp_fd) {
+    io_finish(in);
+    bool ok = io_finish(out);
     close(in);
     close(out);
     close(temp_fd);
-    return;
+    prof_delete(&prof);
+    return ok;
+}
+
+/* helper function to drop the padding of 0 and 255 from the histogram of an input of one
+ * repeated byte (or of none). its tree is then one leaf: the header and a 2-byte tree dump are
+ * the whole file, and the decoder fills the output without reading codes.
+ * returns true if it did */
+static bool drop_padding(uint64_t hist[static ALPHABET]) {
+    uint16_t present = 0, symbol = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++) {
+        uint64_t n = hist[i] - (i == 0 || i == ALPHABET - 1); // without the padding
+        if (n > 0) {
+            present++;
+            symbol = i;
+        }
+    }
+    if (present > 1)
+        return false;
+
+    memset(hist, 0, ALPHABET * sizeof(uint64_t));
+    hist[symbol] = 1; // only its presence matters: it has no code
+    unique_sym = 1;
+    return true;
 }
 
 /* credits: modified version of tally function in entropy.c */
@@ -65,53 +124,38 @@ static void compute_hist(int infile, uint64_t *hist, int temp_fd) {
             write_bytes(temp_fd, buffer, tot_read);
 
         /* increment the character encounter in histogram */
-        for (uint16_t i = 0; i < tot_read; i++) {
-            /* was zero, now it's not. therefore unique */
-            if (hist[buffer[i]] == 0)
-                unique_sym++;
-            hist[buffer[i]]++;
-        }
+        kernels->histogram(buffer, (uint64_t) tot_read, hist);
     }
 
+    /* symbols with a count are unique (0 and 255 included) */
+    unique_sym = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        unique_sym += hist[i] > 0;
+
     free(buffer);
     buffer = NULL;
 
     return;
 }
 
-/* helper function to determine if node's leaf or not */
-static bool is_leaf(Node *n) {
-    if (n)
-        return (!n->left && !n->right); // no child then true, else false
-    return false;
-}
-
-/* helper function to write the tree dump to an array */
-static void tree_dump(Node *n, uint8_t *tree) {
-    static uint16_t at = 0; // keeps track of index in the tree array
-
-    /* at leaf. write L[symbol] */
-    if (is_leaf(n)) {
-        tree[at] = 'L';
-        tree[at + 1] = n->symbol; // write leaf and it's symbol
-        at += 2; // skip over the symbol
-        return;
-    }
-
-    /* recurse from left and right nodes */
-    tree_dump(n->left, tree);
-    tree_dump(n->right, tree);
-
-    tree[at] = 'I';
-    at++; // print the parent node. increment array index
-
-    return;
-}
-
 int main(int argc, char **argv) {
     int c;
-    char *optlist = "hvi:o:";
+    char *optlist = "hvmdbac:w:p:t:e:s:l:j:k:i:o:";
     uint8_t verbose = 0; // no set since only one arg checked/added
+    bool blocks = false; // split into blocks
+    bool append = false; // add to the block stream in outfile
+    bool direct = false; // read and write around the page cache
+    bool measure = false; // profile the phases
+    uint32_t flush_bytes = 0; // stream: flush every flush_bytes bytes (0 for no stream)
+    uint32_t flush_ms = 0; // stream: flush what waited flush_ms ms (0 for no timer)
+    const char *outname = NULL; // path of outfile (to reopen it for appending)
+    BlockOptions opts = { .width = 1, // bytes per symbol tried for each block
+        .planes = 1, // bytes per element split into planes for each block
+        .transforms = 0, // transforms tried for each block
+        .backend = BACKEND_AUTO }; // entropy coder of each block
+    uint32_t threads = 1; // threads writing codes
+    Cache *cache = NULL; // tables shared between files
+    const char *level = NULL; // kernel level to force
 
     /* default file values */
     int infile = STDIN_FILENO;
@@ -131,6 +175,7 @@ int main(int argc, char **argv) {
             break;
 
         case 'o':
+            outname = optarg;
             outfile
                 = open(optarg, O_CREAT | O_WRONLY); // write only output file. create if not present
             if (outfile == -1) {
@@ -142,15 +187,220 @@ int main(int argc, char **argv) {
 
         case 'v': verbose = 1; break;
 
+        case 'b': blocks = true; break;
+
+        case 'd': direct = true; break;
+
+        case 'm': measure = true; break;
+
+        case 'a':
+            append = true;
+            blocks = true; // only block streams can be appended to
+            break;
+
+        case 'c':
+            cache = cache_open(optarg);
+            if (!cache) {
+                fprintf(stderr, "Error: Cannot use cache directory.\n");
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can refer to a cached table
+            break;
+
+        case 'w':
+            opts.width = (uint8_t) strtoul(optarg, NULL, 10);
+            if (strtoul(optarg, NULL, 10) != opts.width || (opts.width != 2 && opts.width != 4)) {
+                fprintf(stderr, "Error: Symbol width must be 2 or 4.\n");
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can hold wide symbols
+            break;
+
+        case 'p':
+            opts.planes = (uint8_t) strtoul(optarg, NULL, 10);
+            if (strtoul(optarg, NULL, 10) != opts.planes || opts.planes < 2
+                || opts.planes > PLANES_MAX) {
+                fprintf(stderr, "Error: Element width must be between 2 and %d.\n", PLANES_MAX);
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can hold planes
+            break;
+
+        case 't':
+            if (strcmp(optarg, "bwt") == 0)
+                opts.transforms |= TRANSFORM_BWT;
+            else if (strcmp(optarg, "words") == 0)
+                opts.transforms |= TRANSFORM_WORDS;
+            else {
+                fprintf(stderr, "Error: Unknown transform.\n");
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can hold transforms
+            break;
+
+        case 'e':
+            if (strcmp(optarg, "auto") == 0)
+                opts.backend = BACKEND_AUTO;
+            else if (strcmp(optarg, "huffman") == 0)
+                opts.backend = BACKEND_HUFFMAN;
+            else if (strcmp(optarg, "ans") == 0) {
+                opts.backend = BACKEND_ANS;
+                blocks = true; // only blocks can hold ans codes
+            } else {
+                fprintf(stderr, "Error: Unknown entropy coder.\n");
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            break;
+
+        case 's':
+            flush_bytes = (uint32_t) strtoul(optarg, NULL, 10);
+            if (strtoul(optarg, NULL, 10) != flush_bytes || flush_bytes == 0
+                || flush_bytes > MAX_SEGMENT) {
+                fprintf(stderr, "Error: Flush size must be between 1 and %d bytes.\n",
+                    MAX_SEGMENT);
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can be flushed
+            break;
+
+        case 'l':
+            flush_ms = (uint32_t) strtoul(optarg, NULL, 10);
+            if (strtoul(optarg, NULL, 10) != flush_ms || flush_ms == 0 || flush_ms > INT32_MAX) {
+                fprintf(stderr, "Error: Flush timer must be at least 1 ms.\n");
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            blocks = true; // only blocks can be flushed
+            break;
+
+        case 'j':
+            threads = (uint32_t) strtoul(optarg, NULL, 10);
+            if (threads == 0 || threads > MAX_THREADS) {
+                fprintf(stderr, "Error: Threads must be between 1 and %d.\n", MAX_THREADS);
+                main_err(infile, outfile, 0);
+                return -1;
+            }
+            break;
+
+        case 'k': level = optarg; break;
+
         default: usage(argv[0]); return -1;
         }
     }
 
+    /* a stream is written as it is read, so it has no size to add to an index with */
+    bool streaming = flush_bytes > 0 || flush_ms > 0;
+    if (streaming && append) {
+        fprintf(stderr, "Error: Cannot append a stream (-s or -l with -a).\n");
+        main_err(infile, outfile, 0);
+        cache_close(&cache);
+        return -1;
+    }
+    if (streaming && flush_bytes == 0)
+        flush_bytes = MAX_SEGMENT; // timer only: flush when a block is full
+
+    /* an append reads the stream it adds to. an empty outfile is written as usual */
+    bool appending = false;
+    off_t old_fz = 0; // bytes of the stream appended to
+    if (append) {
+        if (outname)
+            close(outfile);
+        outfile = outname ? open(outname, O_RDWR) : -1;
+        if (outfile == -1) {
+            fprintf(stderr, "Error: Appending needs an output file (-o).\n");
+            main_err(infile, 0, 0);
+            cache_close(&cache);
+            return -1;
+        }
+        old_fz = lseek(outfile, 0, SEEK_END);
+        appending = old_fz > 0;
+    } else if (outname) {
+        /* an old, longer file would leave a tail decode reads as another (corrupt) stream */
+        if (ftruncate(outfile, 0) != 0 && errno != EINVAL) {
+            fprintf(stderr, "Error: Cannot truncate output file.\n");
+            main_err(infile, outfile, 0);
+            cache_close(&cache);
+            return -1;
+        }
+    }
+
+    /* pick the hot loops for this cpu */
+    if (!kernels_init(level)) {
+        fprintf(stderr, "Error: Unknown or unsupported kernel level.\n");
+        main_err(infile, outfile, 0);
+        cache_close(&cache);
+        return -1;
+    }
+
+    /* counters are opened before the input is touched (a profile is left out if out of memory) */
+    if (measure)
+        prof = prof_create();
+
+    /* bulk jobs keep their data out of the page cache (regular files only. an append reads
+     * back what it adds to) */
+    if (direct) {
+        io_direct(infile, false);
+        if (!append)
+            io_direct(outfile, true);
+    }
+
     /* CREDITS: Modified version (for err handling) of the code snippet in the lab documentation */
     /* file permission setting */
     struct stat statbuf;
     uint64_t comp_fz = 0;
 
+    /* stream. blocks are coded and flushed as the input comes in (no second pass) */
+    if (streaming) {
+        /* the output takes the mode of the input (0600 if it has none), like a file encode */
+        mode_t mode = fstat(infile, &statbuf) == 0 ? statbuf.st_mode : 0600;
+        if (fchmod(outfile, mode) != 0) {
+            fprintf(stderr, "Could not change mode for output file.\n");
+            main_err(infile, outfile, 0);
+            cache_close(&cache);
+            return -1;
+        }
+
+        Header h = { .magic = BLOCK_MAGIC,
+            .permissions = (uint16_t) mode,
+            .tree_size = 0,
+            .file_size = STREAM_SIZE };
+        uint64_t size = 0;
+        int ret = 0;
+        prof_begin(prof);
+        int64_t fz = write_bytes(outfile, (uint8_t *) &h, sizeof(Header)) == sizeof(Header)
+                         ? block_stream(infile, outfile, flush_bytes, flush_ms, &opts, cache, &size)
+                         : -1;
+        prof_end(prof, "stream");
+
+        if (fz < 0) {
+            fprintf(stderr, "Failed to write the stream.\n");
+            ret = -1;
+        } else {
+            comp_fz = sizeof(Header) + (uint64_t) fz;
+            if (verbose) {
+                fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", size);
+                fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp_fz);
+                fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
+                fprintf(stderr, "Space saving: %0.2lf%%\n",
+                    100 * (1 - ((double) comp_fz / size)));
+            }
+            prof_report(prof, size, comp_fz);
+        }
+
+        if (!main_err(infile, outfile, 0) && ret == 0) {
+            fprintf(stderr, "Failed to write the output file.\n");
+            ret = -1;
+        }
+        cache_close(&cache);
+        return ret;
+    }
+
     /* credits: idea from replies on piazza post 749 */
     /* handle case where input file is stdin */
     const char *temp_infile = NULL;
@@ -171,9 +421,26 @@ int main(int argc, char **argv) {
 
     /* histogram of a file */
     uint64_t hist[ALPHABET] = { 0 };
-    hist[0]++;
-    hist[255]++;
-    compute_hist(infile, hist, temp_fd);
+    Segment *segs = NULL;
+    uint32_t nsegs = 0;
+    bool single = false; // one repeated byte: a header only file
+
+    prof_begin(prof);
+    if (blocks) {
+        segs = split_input(infile, temp_fd, hist, &nsegs); // histogram and block boundaries
+        if (!segs) {
+            fprintf(stderr, "Failed to split input into blocks.\n");
+            main_err(infile, outfile, temp_fd);
+            if (temp_infile)
+                remove(temp_infile);
+            return -1;
+        }
+    } else {
+        hist[0]++;
+        hist[255]++;
+        compute_hist(infile, hist, temp_fd);
+        single = drop_padding(hist);
+    }
 
     /* get infile stats (temp file if infile == stdin, else infile) */
     if (fstat(infile == STDIN_FILENO ? temp_fd : infile, &statbuf) != 0) {
@@ -181,25 +448,88 @@ int main(int argc, char **argv) {
         main_err(infile, outfile, 0);
         if (temp_infile)
             remove(temp_infile);
+        free(segs);
         return -1;
     }
+    prof_end(prof, "histogram");
 
-    /* change output file mode */
-    if (fchmod(outfile, statbuf.st_mode) != 0) {
+    /* change output file mode (an appended to file keeps its own) */
+    if (!appending && fchmod(outfile, statbuf.st_mode) != 0) {
         fprintf(stderr, "Could not change mode for output file.\n");
         main_err(infile, outfile, 0);
         if (temp_infile)
             remove(temp_infile); // delete the temp file
+        free(segs);
         return -1;
     }
 
+    /* seek to beginning of this file (tempfile if infile == stdin, else infile) */
+    int seek_from_here = (infile == STDIN_FILENO) ? temp_fd : infile;
+
+    /* block stream. every segment is coded with its own tree */
+    if (blocks) {
+        Header h = { .magic = BLOCK_MAGIC,
+            .permissions = (uint16_t) statbuf.st_mode,
+            .tree_size = 0,
+            .file_size = (uint64_t) statbuf.st_size };
+        int ret = 0;
+        prof_begin(prof);
+        if (io_seek(seek_from_here, 0) == -1) {
+            fprintf(stderr, "Failed to seek the beginning of input file.\n");
+            ret = -1;
+        } else if (appending) {
+            /* a new segment after the blocks already in outfile */
+            int64_t fz = block_append(
+                seek_from_here, outfile, segs, nsegs, h.file_size, &opts, cache);
+            comp_fz = fz > old_fz ? (uint64_t) (fz - old_fz) : 0; // bytes this append added
+            if (fz < 0) {
+                fprintf(stderr, "Failed to append to the output file (not a block stream).\n");
+                ret = -1;
+            } else if (verbose) {
+                fprintf(stderr, "Appended: %" PRIu64 " bytes\n", h.file_size);
+                fprintf(stderr, "Compressed file size: %" PRIu64 " bytes (was %" PRIu64 ")\n",
+                    (uint64_t) fz, (uint64_t) old_fz);
+                fprintf(stderr, "Blocks: %" PRIu32 "\n", nsegs);
+            }
+        } else {
+            comp_fz += write_bytes(outfile, (uint8_t *) &h, sizeof(Header));
+            comp_fz += block_encode(seek_from_here, outfile, segs, nsegs, &opts, cache);
+        }
+        prof_end(prof, "blocks");
+
+        if (ret == 0 && verbose && !appending) {
+            fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", h.file_size);
+            fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp_fz);
+            fprintf(stderr, "Blocks: %" PRIu32 "\n", nsegs);
+            fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
+            fprintf(stderr, "Space saving: %0.2lf%%\n",
+                100 * (1 - ((double) comp_fz / h.file_size)));
+        }
+        if (ret == 0)
+            prof_report(prof, h.file_size, comp_fz);
+
+        if (!main_err(infile, outfile, temp_fd) && ret == 0) {
+            fprintf(stderr, "Failed to write the output file.\n");
+            ret = -1;
+        }
+        if (temp_infile)
+            remove(temp_infile); // delete the temp file
+        free(segs);
+        cache_close(&cache);
+        return ret;
+    }
+
     /* construct a huffman tree */
+    prof_begin(prof);
     Node *root = build_tree(hist);
 
-    /* construct a code table */
+    /* construct a code table. codes too long to pack (only for huge inputs) use the Code table */
+    PackedCode packed[ALPHABET];
+    bool fits = build_packed(root, packed) <= PACKED_MAX;
     Code temp_code = code_init(); // to avoid non-zero elem errors in Code table
     Code table[ALPHABET] = { temp_code };
-    build_codes(root, table);
+    if (!fits)
+        build_codes(root, table);
 
     /* construct and write the header structure (tree size formula credit: from the lab document) */
     uint16_t tree_size = (3 * unique_sym) - 1; // tree size (number of nodes in the tree)
@@ -212,20 +542,16 @@ int main(int argc, char **argv) {
         sizeof(Header)); // write the header and update compressed file size
 
     /* tree dump */
-    uint8_t *tree
-        = (uint8_t *) calloc(tree_size, sizeof(uint8_t)); // made array to make use of write_bytes
-    tree_dump(root, tree);
+    uint8_t tree[MAX_TREE_SIZE]; // made array to make use of write_bytes
+    dump_tree(root, tree);
     comp_fz += write_bytes(outfile, tree, tree_size); // increment the compressed file size
-    free(tree);
-    tree = NULL; // done with tree
+    prof_end(prof, "tree");
 
     /* writes code for each byte in infile to outfile */
 
-    /* seek to beginning of this file (tempfile if infile == stdin, else infile) */
-    int seek_from_here = (infile == STDIN_FILENO) ? temp_fd : infile;
-
     /* seek to the beginning of the file and handle errors */
-    if (lseek(seek_from_here, 0, SEEK_SET) == -1) {
+    prof_begin(prof);
+    if (io_seek(seek_from_here, 0) == -1) {
         fprintf(stderr, "Failed to seek the beginning of input file.\n");
         main_err(infile, outfile, temp_fd);
         if (temp_infile)
@@ -235,33 +561,58 @@ int main(int argc, char **argv) {
     }
 
     /* write each corresponding codes to outfile */
-    uint8_t *buffer = (uint8_t *) calloc(BLOCK, sizeof(uint8_t)); // ~4KB of mem
-    int tot_read;
     uint64_t temp_comp_fz = 0; // tracks number of bits written (for compressed file size tracking)
 
-    /* read BLOCK till EOF */
-    while ((tot_read = read_bytes(seek_from_here, buffer, BLOCK)) > 0) {
-        /* increment the character encounter in histogram */
-        for (uint16_t i = 0; i < tot_read; i++) {
-            /* write code for the correesponding byte (code already in code table) */
-            write_code(outfile, &table[buffer[i]]);
-            temp_comp_fz += table[buffer[i]].top; // increment total bits written
+    /* split the input between threads. each writes its codes at a precomputed bit offset */
+    if (threads > 1 && fits && !single) {
+        int64_t bits = parallel_encode(seek_from_here, outfile, packed, threads);
+        if (bits < 0) {
+            fprintf(stderr, "Failed to encode in parallel.\n");
+            main_err(infile, outfile, temp_fd);
+            if (temp_infile)
+                remove(temp_infile); //delete the temp file
+            delete_tree(&root);
+            return -1;
+        }
+        temp_comp_fz = (uint64_t) bits;
+    } else {
+        uint8_t *buffer = (uint8_t *) calloc(BLOCK, sizeof(uint8_t)); // ~4KB of mem
+        int tot_read;
+
+        /* read BLOCK till EOF (a one leaf tree has no codes to write) */
+        while (!single && (tot_read = read_bytes(seek_from_here, buffer, BLOCK)) > 0) {
+            /* write the codes for the block (codes already in code table) */
+            if (fits) {
+                write_symbols(outfile, packed, buffer, (uint64_t) tot_read);
+                continue;
+            }
+            for (uint16_t i = 0; i < tot_read; i++) {
+                write_code(outfile, &table[buffer[i]]);
+                temp_comp_fz += table[buffer[i]].top; // increment total bits written
+            }
         }
-    }
 
-    /* flush any remaining codes */
-    flush_codes(outfile);
+        /* total bits written (the padding counts of 0 and 255 are not coded) */
+        if (fits) {
+            for (uint16_t i = 0; i < ALPHABET; i++)
+                temp_comp_fz += hist[i] * packed_len(packed[i]);
+            temp_comp_fz -= packed_len(packed[0]) + packed_len(packed[ALPHABET - 1]);
+        }
 
-    free(buffer);
-    buffer = NULL; // done with buffer
+        /* flush any remaining codes */
+        flush_codes(outfile);
 
-    /* print statistics */
-    if (verbose) {
+        free(buffer);
+        buffer = NULL; // done with buffer
+    }
+    prof_end(prof, "codes");
 
-        /* compressed file size = minimum bytes for total bits read in + total bytes read in */
-        temp_comp_fz = temp_comp_fz / BYTE == 0 ? 1 : temp_comp_fz / BYTE + 1;
-        comp_fz += temp_comp_fz;
+    /* compressed file size = minimum bytes for total bits read in + total bytes read in */
+    temp_comp_fz = temp_comp_fz / BYTE == 0 ? 1 : temp_comp_fz / BYTE + 1;
+    comp_fz += temp_comp_fz;
 
+    /* print statistics */
+    if (verbose) {
         fprintf(stderr, "Uncompressed file size: %" PRIu64 " bytes\n", h.file_size);
         fprintf(stderr, "Compressed file size: %" PRIu64 " bytes\n", comp_fz);
 
@@ -271,12 +622,16 @@ int main(int argc, char **argv) {
                     - (((double) comp_fz)
                         / h.file_size))); // formula credit: provided in the lab documentation
         fprintf(stderr, "Space saving: %0.2lf%%\n", space_save);
+        fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
     }
+    prof_report(prof, h.file_size, comp_fz);
 
     /* free mem, close files */
-    main_err(infile, outfile, temp_fd);
+    bool written = main_err(infile, outfile, temp_fd);
+    if (!written)
+        fprintf(stderr, "Failed to write the output file.\n");
     if (temp_infile)
         remove(temp_infile); // delete the temp file
     delete_tree(&root);
-    return 0;
+    return written ? 0 : -1;
 }
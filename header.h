@@ -10,4 +10,56 @@ typedef struct Header {
     uint64_t file_size;
 } Header;
 
+/* block types in a block stream (magic == BLOCK_MAGIC) */
+#define BLOCK_END     0 // end of the stream. comp_size is the bytes of the index block before it
+#define BLOCK_HUFFMAN 1 // tree dump followed by comp_size bytes of codes
+#define BLOCK_WIDE    2 // comp_size bytes: a canonical code for wider symbols, then the codes
+#define BLOCK_PLANES  3 // comp_size bytes: a block for each byte plane of fixed width elements
+#define BLOCK_BWT     4 // comp_size bytes: the row of the input, then a block of its transform
+#define BLOCK_ANS     5 // comp_size bytes: an ans table (normalized counts), then the codes
+#define BLOCK_INDEX   6 // comp_size bytes: an IndexEntry for every segment. no data
+#define BLOCK_WORDS   7 // comp_size bytes: a vocabulary of tokens, then a wide block of their ids
+#define BLOCK_RUN     8 // comp_size is 1: the byte repeated size times (long runs, padding)
+#define BLOCK_SYNC    9 // no data. the sender flushed: everything before it can be decoded
+
+/* file_size of a block stream coded as it was read (flushed a piece at a time) */
+#define STREAM_SIZE UINT64_MAX
+
+/* block flags */
+#define BLOCK_SHARED  0x01 // the tree dump is replaced by the 8-byte id of a cached table
+#define BLOCK_CHECKED 0x02 // the body starts with the crc-32c of the uncompressed block
+
+/* every block in a block stream starts with this header */
+typedef struct BlockHeader {
+    uint8_t type; // one of the BLOCK_* types
+    uint8_t flags; // type specific flags
+    uint16_t tree_size; // size of the tree dump after the header
+    uint32_t size; // uncompressed bytes in the block
+    uint32_t comp_size; // coded bytes after the tree dump
+} BlockHeader;
+
+/* a segment of a block stream that was appended to (BLOCK_INDEX lists them all) */
+typedef struct IndexEntry {
+    uint64_t offset; // offset of the segment's first block from the stream's Header
+    uint64_t size; // uncompressed bytes in the segment
+} IndexEntry;
+
+/* a member in the directory of an archive (ARCHIVE_MAGIC), followed by name_len bytes of its
+ * path. each member is a stream of its own, as encode writes it */
+typedef struct ArchiveEntry {
+    uint64_t offset; // offset of the member's stream in the archive
+    uint64_t comp_size; // bytes of the member's stream
+    uint64_t size; // uncompressed bytes
+    uint16_t permissions; // as in the stream's Header
+    uint16_t name_len; // bytes of the path after the entry (no terminating 0)
+    uint32_t pad;
+} ArchiveEntry;
+
+/* last bytes of an archive: the streams of its members, then their directory, then this */
+typedef struct ArchiveTrailer {
+    uint32_t magic; // ARCHIVE_MAGIC
+    uint32_t count; // members in the directory
+    uint64_t dir_offset; // offset of the directory in the archive
+} ArchiveTrailer;
+
 #endif
@@ -0,0 +1,491 @@
+#include "codec.h"
+#include "defines.h"
+#include "header.h"
+#include "io.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "pool.h"
+#include "table.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define IO_STEP (1 << 30) // most bytes moved by one read_bytes or write_bytes call
+
+/* a member of the archive being created, extracted or listed */
+typedef struct Member {
+    char *name; // path (given when creating, stored when extracting)
+    ArchiveEntry e; // where its stream is and what it holds
+    bool wanted; // extract this member
+    bool ok; // compressed or extracted
+} Member;
+
+/* warm state of one worker, reused for every member it handles */
+typedef struct WorkerState {
+    Codec *codec; // output buffer of the codec
+    uint8_t *buf; // input of the codec
+    uint64_t cap; // room in buf
+} WorkerState;
+
+static WorkerState states[MAX_THREADS];
+static Member *members = NULL;
+static uint32_t nmembers = 0, members_cap = 0;
+static int archive = -1; // archive file
+static uint64_t archive_at = 0; // where the next member's stream goes (when creating)
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER; // guards archive_at and the writes
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A Huffman archiver.\n"
+        "  Compresses many files into one archive on a pool of threads, and extracts them.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-v] [-c | -x | -t] [-j threads] [-k level] [-l list] -f archive\n"
+        "     [path ...]\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -v             Print the members and statistics.\n"
+        "  -c             Create archive from the paths (directories are walked).\n"
+        "  -x             Extract the members named by the paths (default: all).\n"
+        "  -t             List the members.\n"
+        "  -j threads     Worker threads (default: 4).\n"
+        "  -k level       Force the kernels: scalar, sse4.2 or bmi2 (default: best).\n"
+        "  -l list        File of paths to add, one per line (- for stdin).\n"
+        "  -f archive     Archive to create or read.\n",
+        argv);
+
+    return;
+}
+
+/* helper function to make room for size bytes (plus zeroed table slack) in a worker's buffer */
+static bool reserve(WorkerState *w, uint64_t size) {
+    if (size + TABLE_SLACK > w->cap) {
+        uint8_t *grown = (uint8_t *) realloc(w->buf, size + TABLE_SLACK);
+        if (!grown)
+            return false;
+        w->buf = grown;
+        w->cap = size + TABLE_SLACK;
+    }
+    memset(w->buf + size, 0, TABLE_SLACK);
+    return true;
+}
+
+/* helper function to read or write all size bytes of buf (in steps read_bytes can count) */
+static bool move_all(int fd, uint8_t *buf, uint64_t size, bool write) {
+    while (size > 0) {
+        int n = size > IO_STEP ? IO_STEP : (int) size;
+        if ((write ? write_bytes(fd, buf, n) : read_bytes(fd, buf, n)) != n)
+            return false;
+        buf += n;
+        size -= (uint64_t) n;
+    }
+    return true;
+}
+
+/* helper function to read size bytes at offset of fd without moving its offset (workers share
+ * the archive) */
+static bool read_at(int fd, uint8_t *buf, uint64_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t n = pread(fd, buf, size, (off_t) offset);
+        if (n <= 0)
+            return false;
+        buf += n;
+        size -= (uint64_t) n;
+        offset += (uint64_t) n;
+    }
+    return true;
+}
+
+/* helper function to add a member named name. returns false if out of memory */
+static bool add_member(const char *name, size_t len) {
+    if (nmembers == members_cap) {
+        members_cap = members_cap ? 2 * members_cap : 64;
+        Member *grown = (Member *) realloc(members, members_cap * sizeof(Member));
+        if (!grown)
+            return false;
+        members = grown;
+    }
+
+    Member *m = &members[nmembers];
+    memset(m, 0, sizeof(Member));
+    m->name = (char *) malloc(len + 1);
+    if (!m->name)
+        return false;
+    memcpy(m->name, name, len);
+    m->name[len] = '\0';
+    m->e.name_len = (uint16_t) len;
+    m->wanted = true;
+    nmembers++;
+    return true;
+}
+
+/* helper function to add the regular file at path, or every one under it if it is a directory.
+ * other files are skipped. returns false on error */
+static bool add_path(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) {
+        fprintf(stderr, "Error: Cannot stat %s.\n", path);
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        size_t len = strlen(path);
+        if (len > UINT16_MAX) {
+            fprintf(stderr, "Error: Path too long: %s.\n", path);
+            return false;
+        }
+        return add_member(path, len);
+    }
+    if (!S_ISDIR(st.st_mode))
+        return true;
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Error: Cannot open directory %s.\n", path);
+        return false;
+    }
+
+    bool ok = true;
+    size_t len = strlen(path);
+    struct dirent *d;
+    while (ok && (d = readdir(dir))) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        char *child = (char *) malloc(len + strlen(d->d_name) + 2);
+        if (!child) {
+            ok = false;
+            break;
+        }
+        sprintf(child, "%s%s%s", path, len > 0 && path[len - 1] == '/' ? "" : "/", d->d_name);
+        ok = add_path(child);
+        free(child);
+    }
+    closedir(dir);
+    return ok;
+}
+
+/* helper function to add the paths listed in the file list (one per line). returns false on
+ * error */
+static bool add_list(const char *list) {
+    FILE *f = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+    if (!f) {
+        fprintf(stderr, "Error: Cannot open list %s.\n", list);
+        return false;
+    }
+
+    bool ok = true;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while (ok && (len = getline(&line, &cap, f)) != -1) {
+        if (len > 0 && line[len - 1] == '\n')
+            line[--len] = '\0';
+        if (len > 0)
+            ok = add_path(line);
+    }
+
+    free(line);
+    if (f != stdin)
+        fclose(f);
+    return ok;
+}
+
+/* task: compress member index and write its stream at the end of the archive */
+static void compress_member(void *arg, uint32_t worker) {
+    Member *m = &members[(uint32_t) (uintptr_t) arg];
+    WorkerState *w = &states[worker];
+    struct stat st;
+
+    int fd = open(m->name, O_RDONLY);
+    bool ok = fd != -1 && fstat(fd, &st) == 0 && (uint64_t) st.st_size <= CODEC_MAX;
+    uint64_t size = ok ? (uint64_t) st.st_size : 0;
+    if (!ok || !reserve(w, size) || !move_all(fd, w->buf, size, false)) {
+        fprintf(stderr, "Error: Cannot read %s (or bigger than %d bytes).\n", m->name, CODEC_MAX);
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    close(fd);
+
+    uint8_t *out = NULL;
+    int64_t n = codec_compress(w->codec, w->buf, size, (uint16_t) st.st_mode, &out);
+    if (n < 0) {
+        fprintf(stderr, "Error: Cannot compress %s.\n", m->name);
+        return;
+    }
+
+    /* members go in the order they finish. the directory says where */
+    pthread_mutex_lock(&lock);
+    m->e.offset = archive_at;
+    m->e.comp_size = (uint64_t) n;
+    m->e.size = size;
+    m->e.permissions = (uint16_t) st.st_mode;
+    m->ok = move_all(archive, out, (uint64_t) n, true);
+    archive_at += m->ok ? (uint64_t) n : 0;
+    pthread_mutex_unlock(&lock);
+    if (!m->ok)
+        fprintf(stderr, "Error: Cannot write %s to the archive.\n", m->name);
+    return;
+}
+
+/* helper function to return true if name (without leading slashes) stays under the current
+ * directory when extracted */
+static bool safe_name(const char *name) {
+    if (name[0] == '\0')
+        return false;
+    for (const char *p = name; p; p = strchr(p, '/')) {
+        p += *p == '/';
+        if (strncmp(p, "..", 2) == 0 && (p[2] == '/' || p[2] == '\0'))
+            return false;
+    }
+    return true;
+}
+
+/* helper function to create the directories on the way to path */
+static void make_parents(char *path) {
+    for (char *p = strchr(path, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        mkdir(path, 0755); // may already exist
+        *p = '/';
+    }
+    return;
+}
+
+/* task: decompress member index from the archive into its path */
+static void extract_member(void *arg, uint32_t worker) {
+    Member *m = &members[(uint32_t) (uintptr_t) arg];
+    WorkerState *w = &states[worker];
+
+    uint8_t *out = NULL;
+    int64_t n = -1;
+    if (reserve(w, m->e.comp_size) && read_at(archive, w->buf, m->e.comp_size, m->e.offset))
+        n = codec_decompress(w->codec, w->buf, m->e.comp_size, &out);
+    if (n < 0 || (uint64_t) n != m->e.size) {
+        fprintf(stderr, "Error: Corrupt member %s.\n", m->name);
+        return;
+    }
+
+    /* absolute paths are extracted under the current directory */
+    char *dest = m->name + strspn(m->name, "/");
+    make_parents(dest);
+    int fd = open(dest, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+    m->ok = fd != -1 && move_all(fd, out, (uint64_t) n, true) && fchmod(fd, m->e.permissions) == 0;
+    if (fd != -1)
+        close(fd);
+    if (!m->ok)
+        fprintf(stderr, "Error: Cannot write %s.\n", m->name);
+    return;
+}
+
+/* helper function to read the directory of the archive into members. returns false if it is
+ * not an archive */
+static bool read_directory(void) {
+    ArchiveTrailer t;
+    off_t fz = lseek(archive, 0, SEEK_END);
+    if (fz < (off_t) sizeof(ArchiveTrailer)
+        || !read_at(archive, (uint8_t *) &t, sizeof(t), (uint64_t) fz - sizeof(t))
+        || t.magic != ARCHIVE_MAGIC || t.dir_offset > (uint64_t) fz - sizeof(t))
+        return false;
+
+    uint64_t size = (uint64_t) fz - sizeof(t) - t.dir_offset, at = 0;
+    uint8_t *dir = (uint8_t *) malloc(size ? size : 1);
+    bool ok = dir && read_at(archive, dir, size, t.dir_offset);
+
+    for (uint32_t i = 0; ok && i < t.count; i++) {
+        ArchiveEntry e;
+        ok = at + sizeof(e) <= size;
+        if (ok) {
+            memcpy(&e, dir + at, sizeof(e));
+            at += sizeof(e);
+            ok = at + e.name_len <= size && e.offset + e.comp_size <= t.dir_offset
+                 && add_member((const char *) dir + at, e.name_len);
+        }
+        if (ok) {
+            members[nmembers - 1].e = e;
+            at += e.name_len;
+        }
+    }
+
+    free(dir);
+    return ok && at == size;
+}
+
+/* helper function to write the directory and trailer after the members' streams. only members
+ * that made it into the archive are listed. returns false on error */
+static bool write_directory(void) {
+    ArchiveTrailer t = { .magic = ARCHIVE_MAGIC, .count = 0, .dir_offset = archive_at };
+    bool ok = true;
+
+    for (uint32_t i = 0; ok && i < nmembers; i++) {
+        if (!members[i].ok)
+            continue;
+        ok = move_all(archive, (uint8_t *) &members[i].e, sizeof(ArchiveEntry), true)
+             && move_all(archive, (uint8_t *) members[i].name, members[i].e.name_len, true);
+        t.count++;
+    }
+    return ok && move_all(archive, (uint8_t *) &t, sizeof(t), true);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hvcxtj:k:l:f:";
+    uint8_t verbose = 0;
+    char mode = 0; // c, x or t
+    uint32_t threads = 4;
+    const char *level = NULL; // kernel level to force
+    const char *list = NULL; // file of paths to add
+    const char *path = NULL; // archive
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+
+        case 'v': verbose = 1; break;
+
+        case 'c':
+        case 'x':
+        case 't': mode = (char) c; break;
+
+        case 'j':
+            threads = (uint32_t) strtoul(optarg, NULL, 10);
+            if (threads == 0 || threads > MAX_THREADS) {
+                fprintf(stderr, "Error: Threads must be between 1 and %d.\n", MAX_THREADS);
+                return -1;
+            }
+            break;
+
+        case 'k': level = optarg; break;
+
+        case 'l': list = optarg; break;
+
+        case 'f': path = optarg; break;
+
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (!mode || !path || (mode != 'c' && list)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* pick the hot loops for this cpu (before any worker starts) */
+    if (!kernels_init(level)) {
+        fprintf(stderr, "Error: Unknown or unsupported kernel level.\n");
+        return -1;
+    }
+
+    /* the members: given paths when creating, else the archive's directory */
+    bool ok = true;
+    if (mode == 'c') {
+        archive = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        for (int i = optind; ok && i < argc; i++)
+            ok = add_path(argv[i]);
+        if (ok && list)
+            ok = add_list(list);
+    } else {
+        archive = open(path, O_RDONLY);
+        ok = archive != -1 && read_directory();
+        if (archive != -1 && !ok)
+            fprintf(stderr, "Error: %s is not an archive.\n", path);
+
+        /* only the members named, if any. each name must be there */
+        for (uint32_t i = 0; ok && optind < argc && i < nmembers; i++)
+            members[i].wanted = false;
+        for (int i = optind; ok && i < argc; i++) {
+            bool found = false;
+            for (uint32_t j = 0; j < nmembers; j++) {
+                if (strcmp(members[j].name, argv[i]) == 0) {
+                    members[j].wanted = true;
+                    found = true;
+                }
+            }
+            if (!found)
+                fprintf(stderr, "Error: %s is not in the archive.\n", argv[i]);
+            ok = found;
+        }
+    }
+    if (archive == -1)
+        fprintf(stderr, "Error: Cannot open archive %s.\n", path);
+    ok = ok && archive != -1;
+
+    /* list */
+    if (ok && mode == 't') {
+        for (uint32_t i = 0; i < nmembers; i++) {
+            printf("%04o %12" PRIu64 " %12" PRIu64 " %s\n", members[i].e.permissions & 07777,
+                members[i].e.size, members[i].e.comp_size, members[i].name);
+        }
+    }
+
+    /* compress or extract every member on the pool. each worker keeps its own codec */
+    uint32_t done = 0, failed = 0;
+    uint64_t size = 0, comp_size = 0;
+    if (ok && mode != 't') {
+        for (uint32_t i = 0; ok && i < threads; i++)
+            ok = (states[i].codec = codec_create()) != NULL;
+        Pool *pool = ok ? pool_create(threads) : NULL;
+        ok = pool != NULL;
+
+        for (uint32_t i = 0; ok && i < nmembers; i++) {
+            const char *name = members[i].name + strspn(members[i].name, "/");
+            if (mode == 'x' && (!members[i].wanted || !safe_name(name))) {
+                if (members[i].wanted)
+                    fprintf(stderr, "Error: Unsafe path %s not extracted.\n", members[i].name);
+                failed += members[i].wanted;
+                continue;
+            }
+            ok = pool_submit(pool, mode == 'c' ? compress_member : extract_member,
+                (void *) (uintptr_t) i);
+        }
+        pool_delete(&pool); // runs every queued member
+
+        for (uint32_t i = 0; i < nmembers; i++) {
+            if (members[i].ok) {
+                done++;
+                size += members[i].e.size;
+                comp_size += members[i].e.comp_size;
+                if (verbose)
+                    fprintf(stderr, "%s\n", members[i].name);
+            } else if (mode == 'c' || members[i].wanted)
+                failed++;
+        }
+
+        if (!ok)
+            fprintf(stderr, "Error: Out of memory.\n");
+        else if (mode == 'c' && !write_directory()) {
+            fprintf(stderr, "Error: Cannot write the archive directory.\n");
+            ok = false;
+        }
+
+        for (uint32_t i = 0; i < threads; i++) {
+            codec_delete(&states[i].codec);
+            free(states[i].buf);
+        }
+    }
+
+    if (verbose && mode != 't') {
+        fprintf(stderr, "Members: %" PRIu32 " (%" PRIu32 " failed)\n", done, failed);
+        fprintf(stderr, "Uncompressed size: %" PRIu64 " bytes\n", size);
+        fprintf(stderr, "Compressed size: %" PRIu64 " bytes\n", comp_size);
+        fprintf(stderr, "Kernels: %s\n", kernels_name(kernels->level));
+    }
+
+    for (uint32_t i = 0; i < nmembers; i++)
+        free(members[i].name);
+    free(members);
+    if (archive != -1)
+        close(archive);
+    return ok && failed == 0 ? 0 : -1;
+}
@@ -0,0 +1,185 @@
+#include "bwt.h"
+#include "defines.h"
+#include "header.h"
+#include "io.h"
+#include "kernels.h"
+#include "split.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BYTE 8
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A benchmark of the block transforms.\n"
+        "  Reports how much smaller the coded blocks get, how fast the transform runs and the\n"
+        "  slowest disk or network it pays for itself on.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-n rounds] [-z size] [-i infile]\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -n rounds      Times each block is transformed (the fastest counts, default: 5).\n"
+        "  -z size        Bytes of generated log text used without -i (default: 4194304).\n"
+        "  -i infile      Input file to transform (default: generated log text).\n",
+        argv);
+
+    return;
+}
+
+/* helper function to get a monotonic time in ns */
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* helper function to fill buf with log like text (xorshift picks the words) */
+static void fill_text(uint8_t *buf, uint64_t size) {
+    static const char *words[] = { "INFO", "WARN", "ERROR", "request", "served", "in", "ms",
+        "user", "id", "=", "GET", "/api/v1/items", "200", "404", "cache", "miss", "hit", "\n" };
+    uint64_t x = 88172645463325252ULL, at = 0;
+
+    while (at < size) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const char *w = words[x % (sizeof(words) / sizeof(words[0]))];
+        for (uint64_t i = 0; w[i] && at < size; i++)
+            buf[at++] = (uint8_t) w[i];
+        if (at < size)
+            buf[at++] = ' ';
+    }
+}
+
+/* helper function to read all of infile. returns NULL on error */
+static uint8_t *read_all(int infile, uint64_t *size) {
+    uint64_t cap = MAX_SEGMENT;
+    uint8_t *buf = (uint8_t *) malloc(cap);
+    int got;
+
+    *size = 0;
+    while (buf && (got = read_bytes(infile, buf + *size, BLOCK)) > 0) {
+        *size += (uint64_t) got;
+        if (*size + BLOCK > cap) {
+            cap *= 2;
+            uint8_t *grown = (uint8_t *) realloc(buf, cap);
+            if (!grown)
+                free(buf);
+            buf = grown;
+        }
+    }
+    return buf;
+}
+
+/* helper function to return the bits a byte block of buf would code to */
+static uint64_t coded_bits(const uint8_t *buf, uint64_t size) {
+    uint64_t hist[ALPHABET] = { 0 };
+    kernels->histogram(buf, size, hist);
+    return split_cost(hist);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hn:z:i:";
+    uint32_t rounds = 5;
+    uint64_t size = 4 * MAX_SEGMENT;
+    int infile = -1;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+        case 'n': rounds = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 'z': size = strtoull(optarg, NULL, 10); break;
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (infile == -1) {
+                fprintf(stderr, "Error: Cannot open input file.\n");
+                return -1;
+            }
+            break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (rounds == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    kernels_init(NULL);
+
+    uint8_t *in = infile == -1 ? (uint8_t *) malloc(size ? size : 1) : read_all(infile, &size);
+    uint8_t *bwt = (uint8_t *) malloc(MAX_SEGMENT), *out = (uint8_t *) malloc(MAX_SEGMENT);
+    if (infile != -1)
+        close(infile);
+    if (!in || !bwt || !out) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    if (infile == -1)
+        fill_text(in, size);
+    if (size == 0) {
+        fprintf(stderr, "Error: Nothing to transform.\n");
+        return -1;
+    }
+
+    /* every block of the input, transformed and inverted rounds times. the fastest counts */
+    uint64_t plain = 0, coded = 0, fwd_ns = 0, inv_ns = 0, blocks = 0;
+    bool ok = true;
+    for (uint64_t off = 0; ok && off < size; off += MAX_SEGMENT, blocks++) {
+        uint32_t n = (uint32_t) (size - off < MAX_SEGMENT ? size - off : MAX_SEGMENT), primary = 0;
+        uint32_t tsize = 0;
+        uint64_t fwd = UINT64_MAX, inv = UINT64_MAX;
+
+        for (uint32_t r = 0; ok && r < rounds; r++) {
+            uint64_t start = now_ns();
+            tsize = bwt_transform(in + off, n, bwt, MAX_SEGMENT, &primary);
+            uint64_t mid = now_ns();
+            ok = tsize > 0 && bwt_inverse(bwt, tsize, primary, out, n)
+                 && memcmp(out, in + off, n) == 0;
+            uint64_t end = now_ns();
+            fwd = mid - start < fwd ? mid - start : fwd;
+            inv = end - mid < inv ? end - mid : inv;
+        }
+
+        plain += coded_bits(in + off, n);
+        coded += ok ? coded_bits(bwt, tsize) + BYTE * (sizeof(BlockHeader) + 2 * sizeof(uint32_t))
+                    : 0;
+        fwd_ns += fwd;
+        inv_ns += inv;
+    }
+
+    if (!ok) {
+        fprintf(stderr, "Error: A block did not transform back to itself.\n");
+        return -1;
+    }
+
+    /* saving a byte pays for itself if sending or storing it takes longer than the transform
+     * spent on it */
+    double saved = (double) plain / BYTE - (double) coded / BYTE, secs = (fwd_ns + inv_ns) / 1e9;
+    printf("Input: %" PRIu64 " bytes in %" PRIu64 " blocks\n", size, blocks);
+    printf("Coded: %" PRIu64 " bytes, %" PRIu64 " bytes after bwt (%.2lf%% smaller)\n",
+        plain / BYTE, coded / BYTE, plain ? 100 * saved * BYTE / plain : 0);
+    printf("Transform: %.2lf MB/s, inverse: %.2lf MB/s\n", size / (fwd_ns / 1e3),
+        size / (inv_ns / 1e3));
+    if (saved > 0)
+        printf("Pays for itself below: %.2lf MB/s of disk or network\n", saved / secs / 1e6);
+    else
+        printf("Pays for itself below: never (no smaller)\n");
+
+    free(in);
+    free(bwt);
+    free(out);
+    return 0;
+}
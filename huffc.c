@@ -0,0 +1,133 @@
+#include "proto.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A client for the Huffman compression daemon.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-v] [-d] -s socket [-i infile] [-o outfile]\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -v             Print sizes and latency.\n"
+        "  -d             Decompress (default: compress).\n"
+        "  -s socket      Path of the daemon's socket.\n"
+        "  -i infile      Input file (default: stdin).\n"
+        "  -o outfile     Output file (default: stdout).\n",
+        argv);
+
+    return;
+}
+
+/* helper function to read all of fd into a growing buffer. returns the size or -1 */
+static int64_t slurp(int fd, uint8_t **buf) {
+    uint64_t size = 0, cap = 0;
+    ssize_t n;
+
+    *buf = NULL;
+    do {
+        if (size == cap) {
+            cap = cap ? 2 * cap : 1 << 16;
+            uint8_t *grown = (uint8_t *) realloc(*buf, cap);
+            if (!grown)
+                return -1;
+            *buf = grown;
+        }
+        n = read(fd, *buf + size, cap - size);
+        size += n > 0 ? (uint64_t) n : 0;
+    } while (n > 0);
+
+    return n < 0 ? -1 : (int64_t) size;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hvds:i:o:";
+    uint8_t verbose = 0;
+    uint32_t op = OP_COMPRESS;
+    char *path = NULL;
+    int infile = STDIN_FILENO, outfile = STDOUT_FILENO;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+
+        case 'v': verbose = 1; break;
+
+        case 'd': op = OP_DECOMPRESS; break;
+
+        case 's': path = optarg; break;
+
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (infile == -1) {
+                fprintf(stderr, "Error: Cannot open input file.\n");
+                return -1;
+            }
+            break;
+
+        case 'o':
+            outfile = open(optarg, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+            if (outfile == -1) {
+                fprintf(stderr, "Error: Cannot open output file.\n");
+                return -1;
+            }
+            break;
+
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    uint8_t *in = NULL, *out = NULL;
+    uint64_t cap = 0;
+    int64_t size = slurp(infile, &in);
+    int fd = proto_connect(path);
+    int ret = -1;
+
+    if (size < 0)
+        fprintf(stderr, "Error: Cannot read input.\n");
+    else if (fd == -1)
+        fprintf(stderr, "Error: Cannot connect to %s.\n", path);
+    else {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        int64_t n = proto_call(fd, op, in, (uint64_t) size, &out, &cap);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        if (n < 0)
+            fprintf(stderr, "Error: Request failed.\n");
+        else if (proto_send_all(outfile, out, (uint64_t) n)) {
+            ret = 0;
+            if (verbose) {
+                double us = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+                fprintf(stderr, "Input size: %" PRId64 " bytes\n", size);
+                fprintf(stderr, "Output size: %" PRId64 " bytes\n", n);
+                fprintf(stderr, "Latency: %.1lf us\n", us);
+            }
+        }
+    }
+
+    if (fd != -1)
+        close(fd);
+    free(in);
+    free(out);
+    close(infile);
+    close(outfile);
+    return ret;
+}
@@ -0,0 +1,238 @@
+#include "codec.h"
+#include "defines.h"
+#include "kernels.h"
+#include "pool.h"
+#include "proto.h"
+#include "table.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define MAX_WORKERS 256 // most worker threads
+#define MAX_EVENTS  64 // connections woken per epoll_wait
+
+/* warm state of one worker. kept for the life of the daemon so requests reuse it */
+typedef struct WorkerState {
+    Codec *codec; // output buffer and last tables of the codec
+    uint8_t *req; // request payload
+    uint64_t cap; // room in req
+    uint64_t served; // requests handled by this worker
+} WorkerState;
+
+static WorkerState states[MAX_WORKERS];
+static volatile sig_atomic_t stop = 0; // set by SIGINT or SIGTERM
+static int poller = -1; // epoll instance watching the listener and the idle connections
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A Huffman compression daemon.\n"
+        "  Serves compress and decompress requests over a unix domain socket.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-v] [-j workers] [-k level] -s socket\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -v             Print the requests served on exit.\n"
+        "  -j workers     Worker threads (default: 4).\n"
+        "  -k level       Force the kernels: scalar, sse4.2 or bmi2 (default: best).\n"
+        "  -s socket      Path of the socket to listen on.\n",
+        argv);
+
+    return;
+}
+
+/* signal handler to stop accepting connections */
+static void on_signal(int sig) {
+    (void) sig;
+    stop = 1;
+    return;
+}
+
+/* helper function to (re)arm a connection: the next request on it wakes the main loop once */
+static bool arm(int fd, int op) {
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.fd = fd };
+    return epoll_ctl(poller, op, fd, &ev) == 0;
+}
+
+/* helper function to serve one request on a connection. returns false to drop it */
+static bool serve_request(int fd, WorkerState *w) {
+    Request r;
+    if (!proto_recv_all(fd, (uint8_t *) &r, sizeof(r)))
+        return false; // the client hung up
+
+    /* bad request. tell the client and drop the connection */
+    if (r.magic != PROTO_MAGIC || (r.op != OP_COMPRESS && r.op != OP_DECOMPRESS)
+        || r.size > CODEC_MAX) {
+        proto_send(fd, PROTO_MAGIC, STATUS_ERROR, NULL, 0);
+        return false;
+    }
+
+    /* grow the request buffer (zeroed slack for the decoder) */
+    if (r.size + TABLE_SLACK > w->cap) {
+        uint8_t *grown = (uint8_t *) realloc(w->req, r.size + TABLE_SLACK);
+        if (!grown) {
+            proto_send(fd, PROTO_MAGIC, STATUS_ERROR, NULL, 0);
+            return false;
+        }
+        w->req = grown;
+        w->cap = r.size + TABLE_SLACK;
+    }
+    if (!proto_recv_all(fd, w->req, r.size))
+        return false;
+    memset(w->req + r.size, 0, TABLE_SLACK);
+
+    uint8_t *out = NULL;
+    int64_t n = r.op == OP_COMPRESS ? codec_compress(w->codec, w->req, r.size, 0644, &out)
+                                    : codec_decompress(w->codec, w->req, r.size, &out);
+
+    bool sent = n < 0 ? proto_send(fd, PROTO_MAGIC, STATUS_ERROR, NULL, 0)
+                      : proto_send(fd, PROTO_MAGIC, STATUS_OK, out, (uint64_t) n);
+    w->served++;
+    return sent;
+}
+
+/* task: serve the request that woke a connection, then hand the connection back to the main
+ * loop. a worker is never held by a client that keeps its connection open between requests */
+static void serve(void *arg, uint32_t worker) {
+    int fd = (int) (intptr_t) arg;
+    if (!serve_request(fd, &states[worker]) || !arm(fd, EPOLL_CTL_MOD))
+        close(fd); // also takes it out of the epoll set
+    return;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hvj:k:s:";
+    uint8_t verbose = 0;
+    uint32_t workers = 4;
+    char *path = NULL;
+    const char *level = NULL; // kernel level to force
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+
+        case 'v': verbose = 1; break;
+
+        case 'j':
+            workers = (uint32_t) strtoul(optarg, NULL, 10);
+            if (workers == 0 || workers > MAX_WORKERS) {
+                fprintf(stderr, "Error: Workers must be between 1 and %d.\n", MAX_WORKERS);
+                return -1;
+            }
+            break;
+
+        case 's': path = optarg; break;
+
+        case 'k': level = optarg; break;
+
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* pick the hot loops for this cpu (before any worker starts) */
+    if (!kernels_init(level)) {
+        fprintf(stderr, "Error: Unknown or unsupported kernel level.\n");
+        return -1;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long.\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* listen on the socket (replacing a stale one) */
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener == -1 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(listener, SOMAXCONN) == -1) {
+        fprintf(stderr, "Error: Cannot listen on %s.\n", path);
+        if (listener != -1)
+            close(listener);
+        return -1;
+    }
+
+    /* allocate the warm state of each worker up front */
+    for (uint32_t i = 0; i < workers; i++) {
+        if (!(states[i].codec = codec_create())) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            close(listener);
+            unlink(path);
+            return -1;
+        }
+    }
+
+    /* stop on SIGINT or SIGTERM (no SA_RESTART so accept returns). ignore clients that hang up */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    Pool *pool = pool_create(workers);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = listener }, events[MAX_EVENTS];
+    poller = epoll_create1(0);
+    int ret = pool && poller != -1 && epoll_ctl(poller, EPOLL_CTL_ADD, listener, &ev) == 0 ? 0 : -1;
+
+    /* accept connections and hand every request to the pool, one task each */
+    while (ret == 0 && !stop) {
+        int n = epoll_wait(poller, events, MAX_EVENTS, -1);
+        if (n == -1 && errno != EINTR) {
+            fprintf(stderr, "Error: Cannot wait for connections.\n");
+            ret = -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listener) {
+                fd = accept(listener, NULL, NULL);
+                if (fd != -1 && !arm(fd, EPOLL_CTL_ADD))
+                    close(fd);
+                if (fd == -1 && errno != EINTR && errno != ECONNABORTED && errno != EAGAIN) {
+                    fprintf(stderr, "Error: Cannot accept connections.\n");
+                    ret = -1;
+                }
+            } else if (!pool_submit(pool, serve, (void *) (intptr_t) fd)) {
+                close(fd);
+            }
+        }
+    }
+
+    close(listener);
+    unlink(path);
+    pool_delete(&pool); // finishes the requests in progress
+    if (poller != -1)
+        close(poller); // idle connections are closed on exit
+
+    uint64_t served = 0;
+    for (uint32_t i = 0; i < workers; i++) {
+        served += states[i].served;
+        codec_delete(&states[i].codec);
+        free(states[i].req);
+    }
+    if (verbose)
+        fprintf(stderr, "Requests served: %" PRIu64 "\n", served);
+
+    return ret;
+}
@@ -0,0 +1,191 @@
+#include "proto.h"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONNS 256 // most concurrent connections
+
+/* one load generating connection */
+typedef struct Conn {
+    const char *path; // daemon socket
+    uint32_t op; // request type
+    const uint8_t *payload; // sent with every request
+    uint64_t size; // bytes in payload
+    uint64_t *lat; // latency of each request in ns
+    uint64_t requests; // requests to send
+    uint64_t errors; // requests that failed
+} Conn;
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A load generator for the Huffman compression daemon.\n"
+        "  Reports throughput and latency percentiles.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-d] [-c conns] [-n requests] [-z size] -s socket\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -d             Send decompress requests (default: compress).\n"
+        "  -c conns       Concurrent connections (default: 4).\n"
+        "  -n requests    Total requests (default: 10000).\n"
+        "  -z size        Uncompressed payload size in bytes (default: 4096).\n"
+        "  -s socket      Path of the daemon's socket.\n",
+        argv);
+
+    return;
+}
+
+/* helper function to get a monotonic time in ns */
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* helper function to fill buf with log like text (xorshift picks the words) */
+static void fill_payload(uint8_t *buf, uint64_t size) {
+    static const char *words[] = { "INFO", "WARN", "ERROR", "request", "served", "in", "ms",
+        "user", "id", "=", "GET", "/api/v1/items", "200", "404", "cache", "miss", "hit", "\n" };
+    uint64_t x = 88172645463325252ULL, at = 0;
+
+    while (at < size) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const char *w = words[x % (sizeof(words) / sizeof(words[0]))];
+        for (uint64_t i = 0; w[i] && at < size; i++)
+            buf[at++] = (uint8_t) w[i];
+        if (at < size)
+            buf[at++] = ' ';
+    }
+    return;
+}
+
+/* connection thread: send requests back to back and time each one */
+static void *run(void *arg) {
+    Conn *c = (Conn *) arg;
+    uint8_t *out = NULL;
+    uint64_t cap = 0;
+    int fd = proto_connect(c->path);
+
+    for (uint64_t i = 0; i < c->requests; i++) {
+        uint64_t t0 = now_ns();
+        int64_t n = fd == -1 ? -1 : proto_call(fd, c->op, c->payload, c->size, &out, &cap);
+        c->lat[i] = now_ns() - t0;
+
+        /* reconnect after a failure */
+        if (n < 0) {
+            c->errors++;
+            if (fd != -1)
+                close(fd);
+            fd = proto_connect(c->path);
+        }
+    }
+
+    if (fd != -1)
+        close(fd);
+    free(out);
+    return NULL;
+}
+
+/* comparator for qsort */
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hdc:n:z:s:";
+    uint32_t op = OP_COMPRESS, conns = 4;
+    uint64_t requests = 10000, size = 4096;
+    char *path = NULL;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+        case 'd': op = OP_DECOMPRESS; break;
+        case 'c': conns = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 'n': requests = strtoull(optarg, NULL, 10); break;
+        case 'z': size = strtoull(optarg, NULL, 10); break;
+        case 's': path = optarg; break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (!path || conns == 0 || conns > MAX_CONNS || requests < conns) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    uint8_t *payload = (uint8_t *) malloc(size ? size : 1), *comp = NULL;
+    uint64_t *lat = (uint64_t *) calloc(requests, sizeof(uint64_t)), cap = 0;
+    if (!payload || !lat) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    fill_payload(payload, size);
+    uint64_t payload_size = size;
+
+    /* decompress requests send the daemon's own compressed payload */
+    if (op == OP_DECOMPRESS) {
+        int fd = proto_connect(path);
+        int64_t n = fd == -1 ? -1 : proto_call(fd, OP_COMPRESS, payload, size, &comp, &cap);
+        if (fd != -1)
+            close(fd);
+        if (n < 0) {
+            fprintf(stderr, "Error: Cannot compress the payload.\n");
+            return -1;
+        }
+        payload_size = (uint64_t) n;
+    }
+
+    Conn cs[MAX_CONNS];
+    pthread_t tids[MAX_CONNS];
+    uint64_t start = now_ns(), given = 0;
+
+    for (uint32_t i = 0; i < conns; i++) {
+        uint64_t share = requests / conns + (i < requests % conns);
+        cs[i] = (Conn) { .path = path,
+            .op = op,
+            .payload = op == OP_DECOMPRESS ? comp : payload,
+            .size = payload_size,
+            .lat = lat + given,
+            .requests = share,
+            .errors = 0 };
+        given += share;
+        pthread_create(&tids[i], NULL, run, &cs[i]);
+    }
+
+    uint64_t errors = 0;
+    for (uint32_t i = 0; i < conns; i++) {
+        pthread_join(tids[i], NULL);
+        errors += cs[i].errors;
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    qsort(lat, requests, sizeof(uint64_t), cmp_u64);
+
+    printf("Requests: %" PRIu64 " (%" PRIu64 " errors) on %" PRIu32 " connections\n", requests,
+        errors, conns);
+    printf("Throughput: %.0lf req/s, %.2lf MB/s uncompressed\n", requests / secs,
+        requests * (double) size / secs / 1e6);
+    printf("Latency: p50 %.1lf us, p90 %.1lf us, p99 %.1lf us, max %.1lf us\n",
+        lat[requests / 2] / 1e3, lat[requests * 9 / 10] / 1e3, lat[requests * 99 / 100] / 1e3,
+        lat[requests - 1] / 1e3);
+
+    free(payload);
+    free(comp);
+    free(lat);
+    return errors ? -1 : 0;
+}
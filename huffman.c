@@ -77,29 +77,109 @@ void build_codes(Node *root, Code table[static ALPHABET]) {
     return;
 }
 
+/* recursive helper function to write the tree dump to an array */
+static void dump_traverse(Node *n, uint8_t *tree, uint16_t *at) {
+
+    /* at leaf. write L[symbol] */
+    if (is_leaf(n)) {
+        tree[*at] = 'L';
+        tree[*at + 1] = n->symbol; // write leaf and it's symbol
+        *at += 2; // skip over the symbol
+        return;
+    }
+
+    /* recurse from left and right nodes */
+    dump_traverse(n->left, tree, at);
+    dump_traverse(n->right, tree, at);
+
+    tree[*at] = 'I';
+    *at += 1; // print the parent node. increment array index
+
+    return;
+}
+
+/* writes the post-order tree dump to tree. returns the dump size in bytes */
+uint16_t dump_tree(Node *root, uint8_t tree[static MAX_TREE_SIZE]) {
+    uint16_t at = 0; // index in the tree array (local so that many trees can be dumped)
+    if (root)
+        dump_traverse(root, tree, &at);
+    return at;
+}
+
+/* recursive helper function to build packed codes. the code is carried in bits and len */
+static uint32_t packed_traverse(
+    Node *n, PackedCode table[static ALPHABET], uint64_t bits, uint32_t len) {
+
+    /* found a leaf. add its code (if it fits) */
+    if (is_leaf(n)) {
+        table[n->symbol] = len <= PACKED_MAX ? bits << PACKED_LEN | len : 0;
+        return len;
+    }
+
+    /* 0 for left, 1 for right. bits past PACKED_MAX are dropped (the code does not fit) */
+    uint64_t right = len < PACKED_MAX ? bits | (uint64_t) 1 << len : bits;
+    uint32_t left_max = packed_traverse(n->left, table, bits, len + 1);
+    uint32_t right_max = packed_traverse(n->right, table, right, len + 1);
+
+    return left_max > right_max ? left_max : right_max;
+}
+
+/* builds packed codes for huffman tree. symbols without a code get 0.
+ * returns the longest code length (codes longer than PACKED_MAX are not packed) */
+uint32_t build_packed(Node *root, PackedCode table[static ALPHABET]) {
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        table[i] = 0;
+    return root ? packed_traverse(root, table, 0, 0) : 0;
+}
+
 /* algo credits: based upon the lab document description */
-/* builds a huffman tree from a tree dump */
+/* builds a huffman tree from a tree dump. the dump is not trusted: it must be a post-order walk
+ * of one full tree (every parent has two children) with each symbol at most once, so decoders
+ * can walk the tree without checking for missing children. returns NULL if it is not (or if
+ * out of memory) */
 Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]) {
     Node *n = NULL, *left = NULL, *right = NULL;
     Stack *s = stack_create(ALPHABET); // max stack size can grow to 256
+    bool seen[ALPHABET] = { false }; // symbols with a leaf
+    bool ok = s != NULL && nbytes > 0;
 
-    for (uint16_t i = 0; i < nbytes; i++) {
+    for (uint16_t i = 0; ok && i < nbytes; i++) {
         /* add a leaf node */
         if (tree[i] == 'L') {
+            ok = i + 1 < nbytes && !seen[tree[i + 1]]; // a symbol follows and is new
+            if (!ok)
+                break;
+            seen[tree[i + 1]] = true;
             n = node_create(tree[i + 1], 0); // add a node with symbol = char followed by L
-            stack_push(s, n); // push to stack (node freq doesnt matter)
+            ok = n && stack_push(s, n); // push to stack (node freq doesnt matter)
+            if (n && !ok)
+                node_delete(&n);
             i += 1; // skip next iteration
         }
         /* at parent node. pop two nodes, join & push them */
-        else {
+        else if (tree[i] == 'I' && stack_size(s) >= 2) {
             stack_pop(s, &right);
             stack_pop(s, &left);
             n = node_join(left, right);
-            stack_push(s, n);
+            ok = n && stack_push(s, n); // room, since two were popped
+            if (!n) {
+                delete_tree(&left); // off the stack, so freed here
+                delete_tree(&right);
+            }
+        } else {
+            ok = false; // unknown byte or a parent without two children
         }
     }
 
-    /* free stack mem */
+    /* the whole dump is one tree */
+    ok = ok && stack_size(s) == 1;
+    n = NULL;
+    if (ok)
+        stack_pop(s, &n);
+
+    /* free the subtrees of a bad dump, then the stack mem */
+    while (!ok && stack_pop(s, &left))
+        delete_tree(&left);
     stack_delete(&s);
 
     return n; // the root node
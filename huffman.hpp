@@ -0,0 +1,394 @@
+#ifndef __HUFFMAN_HPP__
+#define __HUFFMAN_HPP__
+
+/* a header only c++ layer over the codec. huff::Codec owns an in memory codec (codec.h) and
+ * huff::Coder is a huffman coder specialized at compile time on its symbol type, longest code
+ * and number of interleaved streams. a Coder's code and decode tables are built (constexpr) from
+ * a fixed histogram, so a known distribution costs no table setup at run time */
+
+extern "C" {
+#include "codec.h"
+
+bool kernels_init(const char *force); // kernels.h itself is c only (static array parameters)
+}
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace huff {
+
+constexpr size_t SLACK = 8; // readable bytes the decoders need past the end of their input
+
+/* picks the kernels the codec uses: the best the cpu supports, or the level named by force */
+inline bool init(const char *force = nullptr) {
+    return kernels_init(force);
+}
+
+/* an in memory codec. results are copied out of the codec's buffer, which the next call reuses */
+class Codec {
+public:
+    Codec() : c(codec_create()) {}
+    ~Codec() {
+        codec_delete(&c);
+    }
+    Codec(const Codec &) = delete;
+    Codec &operator=(const Codec &) = delete;
+    Codec(Codec &&o) noexcept : c(std::exchange(o.c, nullptr)), padded(std::move(o.padded)) {}
+    Codec &operator=(Codec &&o) noexcept {
+        std::swap(c, o.c);
+        std::swap(padded, o.padded);
+        return *this;
+    }
+
+    /* false if the codec could not be made */
+    explicit operator bool() const {
+        return c != nullptr;
+    }
+
+    /* compresses in to the format encode writes. returns nothing on error */
+    std::optional<std::vector<uint8_t>> compress(
+        const uint8_t *in, uint64_t size, uint16_t permissions = 0644) {
+        uint8_t *out = nullptr;
+        int64_t n = c ? codec_compress(c, in, size, permissions, &out) : -1;
+        if (n < 0)
+            return std::nullopt;
+        return std::vector<uint8_t>(out, out + n);
+    }
+
+    std::optional<std::vector<uint8_t>> compress(
+        const std::vector<uint8_t> &in, uint16_t permissions = 0644) {
+        return compress(in.data(), in.size(), permissions);
+    }
+
+    /* decompresses what encode (or compress) wrote. returns nothing if in is not valid */
+    std::optional<std::vector<uint8_t>> decompress(const uint8_t *in, uint64_t size) {
+        uint8_t *out = nullptr;
+        padded.assign(in, in + size);
+        padded.resize(size + SLACK);
+        int64_t n = c ? codec_decompress(c, padded.data(), size, &out) : -1;
+        if (n < 0)
+            return std::nullopt;
+        return std::vector<uint8_t>(out, out + n);
+    }
+
+    std::optional<std::vector<uint8_t>> decompress(const std::vector<uint8_t> &in) {
+        return decompress(in.data(), in.size());
+    }
+
+private:
+    ::Codec *c;
+    std::vector<uint8_t> padded; // input with the slack the codec reads past its end
+};
+
+namespace detail {
+
+template <typename T> constexpr void swap_at(T &a, T &b) {
+    T t = a;
+    a = b;
+    b = t;
+}
+
+/* true if symbol a sorts after symbol b: bigger count, then bigger symbol */
+template <size_t N>
+constexpr bool heavier(const std::array<uint64_t, N> &hist, uint32_t a, uint32_t b) {
+    return hist[a] != hist[b] ? hist[a] > hist[b] : a > b;
+}
+
+/* helper function to sift entry i down the max heap of the first n entries of heap */
+template <size_t N>
+constexpr void sift(std::array<uint32_t, N> &heap, size_t i, size_t n,
+    const std::array<uint64_t, N> &hist) {
+    for (size_t child = 2 * i + 1; child < n; i = child, child = 2 * i + 1) {
+        if (child + 1 < n && heavier(hist, heap[child + 1], heap[child]))
+            child++;
+        if (!heavier(hist, heap[child], heap[i]))
+            return;
+        swap_at(heap[i], heap[child]);
+    }
+}
+
+/* sorts the first n symbols of order lightest first (a heap sort, since std::sort is not
+ * constexpr before c++20) */
+template <size_t N>
+constexpr void sort_symbols(
+    std::array<uint32_t, N> &order, size_t n, const std::array<uint64_t, N> &hist) {
+    for (size_t i = n / 2; i-- > 0;)
+        sift(order, i, n, hist);
+    for (size_t end = n; end-- > 1;) {
+        swap_at(order[0], order[end]);
+        sift(order, 0, end, hist);
+    }
+}
+
+/* counts the codes of each length in a huffman code for the n symbols of order (lightest
+ * first). codes longer than MaxLen are counted at MaxLen. the leaves and the internal nodes
+ * each come off a queue in weight order, so no heap is needed */
+template <unsigned MaxLen, size_t N>
+constexpr std::array<uint32_t, MaxLen + 1> huffman_counts(const std::array<uint32_t, N> &order,
+    size_t n, const std::array<uint64_t, N> &hist) {
+    std::array<uint32_t, MaxLen + 1> count {};
+    if (n <= 1) {
+        count[1] = (uint32_t) n; // one symbol still takes a bit
+        return count;
+    }
+
+    std::array<uint64_t, N> weight {}; // of internal node k, the k-th made
+    std::array<uint32_t, N> leaf_parent {}, node_parent {}, depth {};
+    size_t leaf = 0, node = 0;
+    for (size_t made = 0; made + 1 < n; made++) {
+        for (uint32_t pick = 0; pick < 2; pick++) {
+            if (leaf < n && (node == made || hist[order[leaf]] <= weight[node])) {
+                weight[made] += hist[order[leaf]];
+                leaf_parent[leaf++] = (uint32_t) made;
+            } else {
+                weight[made] += weight[node];
+                node_parent[node++] = (uint32_t) made;
+            }
+        }
+    }
+
+    /* the root is the last node made, and every node is made after its children */
+    for (size_t k = n - 2; k-- > 0;)
+        depth[k] = depth[node_parent[k]] + 1;
+    for (size_t j = 0; j < n; j++) {
+        uint32_t len = depth[leaf_parent[j]] + 1;
+        count[len < MaxLen ? len : MaxLen]++;
+    }
+    return count;
+}
+
+/* helper function to make the lengths in count a complete prefix code again after the long
+ * codes were cut to MaxLen: codes just under MaxLen are pushed down till the kraft sum fits,
+ * then the shortest codes are pulled up into the room that is left */
+template <unsigned MaxLen> constexpr void limit_counts(std::array<uint32_t, MaxLen + 1> &count) {
+    const uint64_t cap = (uint64_t) 1 << MaxLen;
+    uint64_t kraft = 0; // in units of 2^-MaxLen
+    for (unsigned l = 1; l <= MaxLen; l++)
+        kraft += (uint64_t) count[l] << (MaxLen - l);
+
+    while (kraft > cap) {
+        unsigned l = MaxLen - 1;
+        while (count[l] == 0)
+            l--;
+        count[l]--;
+        count[l + 1]++;
+        kraft -= (uint64_t) 1 << (MaxLen - l - 1);
+    }
+    for (unsigned l = 2; l <= MaxLen; l++) {
+        while (count[l] > 0 && kraft + ((uint64_t) 1 << (MaxLen - l)) <= cap) {
+            count[l]--;
+            count[l - 1]++;
+            kraft += (uint64_t) 1 << (MaxLen - l);
+        }
+    }
+}
+
+/* helper function to reverse the low len bits of v (canonical codes are msb first, the streams
+ * are written first bit lowest) */
+constexpr uint32_t reverse_bits(uint32_t v, unsigned len) {
+    uint32_t r = 0;
+    for (unsigned i = 0; i < len; i++, v >>= 1)
+        r = (r << 1) | (v & 1);
+    return r;
+}
+
+} // namespace detail
+
+/* a canonical huffman coder of Sym symbols (8 or 16 bits, an alphabet of N) with codes of at
+ * most MaxLen bits, interleaving symbol i into stream i % Streams. made from a constexpr
+ * histogram its tables are compile time constants (a Coder can also be made at run time from a
+ * measured one). the coded form is the bits of each stream (uint32) then the streams, each
+ * starting on a byte. the symbol count is not stored: the caller's framing knows it */
+template <typename Sym, unsigned MaxLen, unsigned Streams,
+    size_t N = (size_t) 1 << (8 * sizeof(Sym))>
+class Coder {
+    static_assert(std::is_unsigned<Sym>::value && sizeof(Sym) <= 2, "symbols are 8 or 16 bits");
+    static_assert(N >= 1 && N <= ((size_t) 1 << (8 * sizeof(Sym))), "alphabet too wide");
+    static_assert(MaxLen >= 1 && MaxLen <= 16, "codes are 1 to 16 bits");
+    static_assert(N <= ((size_t) 1 << MaxLen), "every symbol needs room for a code");
+    static_assert(Streams >= 1 && Streams <= 32, "1 to 32 streams");
+
+public:
+    /* code of a symbol (first bit lowest) and its length. 0 bits for a symbol never seen */
+    struct Entry {
+        uint32_t bits = 0;
+        uint8_t len = 0;
+    };
+
+    /* entry of the decode table, indexed by the next MaxLen bits of a stream */
+    struct DecodeEntry {
+        Sym sym = 0;
+        uint8_t len = MaxLen; // unused codes read MaxLen bits and fail the final check
+    };
+
+    static constexpr size_t HEADER = Streams * sizeof(uint32_t); // bytes before the streams
+
+    constexpr explicit Coder(const std::array<uint64_t, N> &hist) {
+        std::array<uint32_t, N> order {};
+        size_t n = 0;
+        for (size_t s = 0; s < N; s++)
+            if (hist[s] > 0)
+                order[n++] = (uint32_t) s;
+        detail::sort_symbols(order, n, hist);
+
+        /* lengths by count, the heaviest symbols getting the shortest */
+        std::array<uint32_t, MaxLen + 1> count = detail::huffman_counts<MaxLen>(order, n, hist);
+        detail::limit_counts<MaxLen>(count);
+        for (unsigned l = 1, j = (unsigned) n; l <= MaxLen; l++)
+            for (uint32_t c = 0; c < count[l]; c++)
+                enc[order[--j]].len = (uint8_t) l;
+
+        /* canonical codes: by length, then symbol */
+        std::array<uint32_t, MaxLen + 1> next {};
+        for (unsigned l = 1, code = 0; l <= MaxLen; l++) {
+            code = (code + count[l - 1]) << 1;
+            next[l] = code;
+        }
+        for (size_t s = 0; s < N; s++) {
+            unsigned len = enc[s].len;
+            if (len == 0)
+                continue;
+            enc[s].bits = detail::reverse_bits(next[len]++, len);
+            for (uint32_t i = enc[s].bits; i < dec.size(); i += (uint32_t) 1 << len)
+                dec[i] = DecodeEntry { (Sym) s, (uint8_t) len };
+        }
+    }
+
+    constexpr const Entry &code(Sym s) const {
+        return enc[s];
+    }
+
+    /* returns the bytes encode makes of n symbols of in, or 0 if one of them has no code */
+    size_t encoded_size(const Sym *in, size_t n) const {
+        std::array<uint64_t, Streams> bits {};
+        if (!stream_bits(in, n, bits))
+            return 0;
+        size_t size = HEADER;
+        for (unsigned k = 0; k < Streams; k++)
+            size += (bits[k] + 7) / 8;
+        return size;
+    }
+
+    /* codes n symbols of in into out (cap bytes). returns the bytes written, or 0 if a symbol
+     * has no code or they do not fit */
+    size_t encode(const Sym *in, size_t n, uint8_t *out, size_t cap) const {
+        std::array<uint64_t, Streams> bits {}, acc {};
+        std::array<size_t, Streams> at {};
+        std::array<uint32_t, Streams> nacc {};
+        if (!stream_bits(in, n, bits))
+            return 0;
+        size_t size = HEADER;
+        for (unsigned k = 0; k < Streams; k++) {
+            if (bits[k] > UINT32_MAX)
+                return 0;
+            at[k] = size;
+            size += (bits[k] + 7) / 8;
+        }
+        if (size > cap)
+            return 0;
+        for (unsigned k = 0; k < Streams; k++) {
+            uint32_t b = (uint32_t) bits[k];
+            std::memcpy(out + k * sizeof(uint32_t), &b, sizeof(uint32_t));
+        }
+
+        /* the streams' regions were sized exactly, so writes need no checks */
+        auto put = [&](unsigned k, Sym s) {
+            acc[k] |= (uint64_t) enc[s].bits << nacc[k];
+            nacc[k] += enc[s].len;
+            if (nacc[k] >= 32) {
+                std::memcpy(out + at[k], &acc[k], sizeof(uint32_t));
+                at[k] += sizeof(uint32_t);
+                acc[k] >>= 32;
+                nacc[k] -= 32;
+            }
+        };
+        size_t i = 0;
+        for (; i + Streams <= n; i += Streams)
+            for (unsigned k = 0; k < Streams; k++)
+                put(k, in[i + k]);
+        for (unsigned k = 0; i < n; i++, k++)
+            put(k, in[i]);
+        for (unsigned k = 0; k < Streams; k++)
+            std::memcpy(out + at[k], &acc[k], (nacc[k] + 7) / 8);
+        return size;
+    }
+
+    /* decodes n symbols from in (size bytes from encode) into out. in needs SLACK readable bytes
+     * past its end. returns false if in is not n symbols coded by this coder */
+    bool decode(const uint8_t *in, size_t size, Sym *out, size_t n) const {
+        std::array<uint64_t, Streams> pos {}, end {};
+        if (size < HEADER)
+            return false;
+        uint64_t at = HEADER;
+        for (unsigned k = 0; k < Streams; k++) {
+            uint32_t bits;
+            std::memcpy(&bits, in + k * sizeof(uint32_t), sizeof(uint32_t));
+            pos[k] = at * 8;
+            end[k] = pos[k] + bits;
+            at += (bits + 7) / 8;
+        }
+        if (at != size)
+            return false;
+
+        const uint64_t mask = ((uint64_t) 1 << MaxLen) - 1, limit = (uint64_t) size * 8;
+        auto get = [&](unsigned k) {
+            uint64_t word;
+            std::memcpy(&word, in + pos[k] / 8, sizeof(word));
+            const DecodeEntry &e = dec[(word >> (pos[k] % 8)) & mask];
+            pos[k] += e.len;
+            return e.sym;
+        };
+
+        /* a symbol takes at most MaxLen bits, so rounds run unchecked while no stream can read
+         * past the input (a corrupt stream may wander into the next one, which the final check
+         * catches) */
+        size_t i = 0;
+        while (i + Streams <= n) {
+            uint64_t furthest = 0;
+            for (unsigned k = 0; k < Streams; k++)
+                furthest = pos[k] > furthest ? pos[k] : furthest;
+            if (furthest > limit)
+                return false;
+            size_t rounds = (n - i) / Streams, safe = (size_t) ((limit - furthest) / MaxLen) + 1;
+            for (size_t r = rounds < safe ? rounds : safe; r > 0; r--, i += Streams)
+                for (unsigned k = 0; k < Streams; k++)
+                    out[i + k] = get(k);
+        }
+        for (unsigned k = 0; i < n; i++, k++) {
+            if (pos[k] > limit)
+                return false;
+            out[i] = get(k);
+        }
+
+        bool done = true;
+        for (unsigned k = 0; k < Streams; k++)
+            done = done && pos[k] == end[k];
+        return done;
+    }
+
+private:
+    std::array<Entry, N> enc {};
+    std::array<DecodeEntry, (size_t) 1 << MaxLen> dec {};
+
+    /* helper function to add up the bits of each stream. returns false if a symbol has no code
+     * (or is outside the alphabet) */
+    bool stream_bits(const Sym *in, size_t n, std::array<uint64_t, Streams> &bits) const {
+        bool missing = false;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t len = (size_t) in[i] < N ? enc[in[i]].len : 0;
+            bits[i % Streams] += len;
+            missing |= len == 0;
+        }
+        return !missing;
+    }
+};
+
+} // namespace huff
+
+#endif
@@ -0,0 +1,290 @@
+#include "code.h"
+#include "defines.h"
+#include "huffman.h"
+#include "io.h"
+#include "kernels.h"
+#include "node.h"
+#include "pq.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#define X86 1
+#else
+#define X86 0
+#endif
+
+#define BYTE  8
+#define BATCH 64 // trees built (or codes built) per timed call
+
+/* a histogram shape the primitives are timed on */
+typedef struct Shape {
+    const char *name;
+    uint64_t hist[ALPHABET];
+} Shape;
+
+/* time taken by one timed run */
+typedef struct Sample {
+    uint64_t ns;
+    uint64_t cycles; // time stamp counter ticks (0 where there is none)
+} Sample;
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  A microbenchmark of the tree, code and bit I/O primitives.\n"
+        "  Times each primitive on its own over fixed histograms and reports the fastest of\n"
+        "  the rounds in ns per operation (and bytes per cycle for the bit I/O).\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-n rounds] [-s symbols]\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -n rounds      Timed rounds of each benchmark after a warm up (default: 7).\n"
+        "  -s symbols     Symbols written and read back by the bit I/O (default: 1048576).\n",
+        argv);
+
+    return;
+}
+
+/* helper function to get a monotonic time in ns */
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* helper function to read the time stamp counter (0 where there is none) */
+static uint64_t now_cycles(void) {
+#if X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* helper function to start a timed run */
+static Sample start(void) {
+    return (Sample) { .ns = now_ns(), .cycles = now_cycles() };
+}
+
+/* helper function to end a timed run, keeping the fastest in best */
+static void stop(Sample s, Sample *best) {
+    uint64_t cycles = now_cycles(), ns = now_ns();
+    if (ns - s.ns < best->ns) {
+        best->ns = ns - s.ns;
+        best->cycles = cycles - s.cycles;
+    }
+    return;
+}
+
+/* helper function to step a xorshift generator */
+static uint64_t next_rand(uint64_t *x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* helper function to fill the histograms: a few equal symbols, zipf over every symbol, one
+ * dominant symbol and every symbol with random counts */
+static void make_shapes(Shape shapes[static 4]) {
+    uint64_t x = 88172645463325252ULL;
+
+    memset(shapes, 0, 4 * sizeof(Shape));
+    shapes[0].name = "flat";
+    shapes[1].name = "zipf";
+    shapes[2].name = "dominant";
+    shapes[3].name = "all256";
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        shapes[0].hist[s] = s < 64 ? 1000 : 0;
+        shapes[1].hist[s] = 1000000 / (s + 1);
+        shapes[2].hist[s] = s == 0 ? 950000 : s <= 32 ? 50000 / 32 : 0;
+        shapes[3].hist[s] = 1 + next_rand(&x) % 10000;
+    }
+    return;
+}
+
+/* helper function to draw n symbols from hist into out */
+static void draw(const uint64_t hist[static ALPHABET], uint8_t *out, uint64_t n) {
+    uint64_t cumul[ALPHABET], total = 0, x = 2463534242ULL;
+    for (uint16_t s = 0; s < ALPHABET; s++)
+        cumul[s] = total += hist[s];
+
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t r = next_rand(&x) % total;
+        uint16_t lo = 0, hi = ALPHABET - 1;
+        while (lo < hi) {
+            uint16_t mid = (lo + hi) / 2;
+            if (cumul[mid] > r)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        out[i] = (uint8_t) lo;
+    }
+    return;
+}
+
+/* helper function to print one result */
+static void report(const char *shape, const char *name, Sample best, uint64_t ops, uint64_t bytes) {
+    printf("%-10s %-20s %12.2lf", shape, name, (double) best.ns / ops);
+    if (bytes && best.cycles)
+        printf(" %12.4lf\n", (double) bytes / best.cycles);
+    else
+        printf(" %12s\n", "-");
+    return;
+}
+
+/* times every primitive over shape. returns false on error */
+static bool bench_shape(const Shape *shape, uint32_t rounds, const uint8_t *syms, uint64_t nsyms) {
+    Sample pq = { UINT64_MAX, 0 }, build = pq, codes = pq, rebuild = pq, write = pq, read = pq;
+    Node *nodes[ALPHABET], *roots[BATCH];
+    uint16_t unique = 0;
+
+    for (uint16_t s = 0; s < ALPHABET; s++) {
+        if (shape->hist[s] > 0)
+            nodes[unique++] = node_create((uint8_t) s, shape->hist[s]);
+    }
+
+    /* the tree, its codes and its dump, used by the benchmarks that do not build them */
+    Node *root = build_tree((uint64_t *) shape->hist);
+    static Code table[ALPHABET];
+    uint8_t tree[MAX_TREE_SIZE];
+    build_codes(root, table);
+    uint16_t tree_size = dump_tree(root, tree);
+
+    /* the codes of the symbols, padded to whole io blocks so read_bit ends each round where
+     * it starts */
+    char path[] = "/tmp/huffmicroXXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        delete_tree(&root);
+        for (uint16_t i = 0; i < unique; i++)
+            node_delete(&nodes[i]);
+        return false;
+    }
+    unlink(path);
+    PriorityQueue *q = pq_create(ALPHABET);
+    bool ok = q != NULL;
+
+    for (uint32_t r = 0; ok && r <= rounds; r++) {
+        Sample t = start();
+        for (uint16_t i = 0; i < unique; i++)
+            enqueue(q, nodes[i]);
+        for (Node *n; !pq_empty(q);)
+            dequeue(q, &n);
+        stop(t, &pq);
+
+        t = start();
+        for (uint32_t b = 0; b < BATCH; b++)
+            roots[b] = build_tree((uint64_t *) shape->hist);
+        stop(t, &build);
+        for (uint32_t b = 0; b < BATCH; b++)
+            delete_tree(&roots[b]);
+
+        t = start();
+        for (uint32_t b = 0; b < BATCH; b++)
+            build_codes(root, table);
+        stop(t, &codes);
+
+        t = start();
+        for (uint32_t b = 0; b < BATCH; b++)
+            roots[b] = rebuild_tree(tree_size, tree);
+        stop(t, &rebuild);
+        for (uint32_t b = 0; b < BATCH; b++)
+            delete_tree(&roots[b]);
+
+        ok = lseek(fd, 0, SEEK_SET) == 0 && ftruncate(fd, 0) == 0;
+        t = start();
+        for (uint64_t i = 0; ok && i < nsyms; i++)
+            write_code(fd, &table[syms[i]]);
+        flush_codes(fd);
+        stop(t, &write);
+
+        off_t coded = lseek(fd, 0, SEEK_END);
+        uint64_t blocks = ((uint64_t) coded + BLOCK - 1) / BLOCK;
+        ok = ok && coded > 0 && ftruncate(fd, (off_t) (blocks * BLOCK)) == 0
+             && lseek(fd, 0, SEEK_SET) == 0;
+        t = start();
+        for (uint64_t i = 0; ok && i < blocks * BLOCK * BYTE; i++)
+            read_bit(fd, NULL);
+        stop(t, &read);
+
+        /* the warm up round does not count */
+        if (r == 0)
+            pq = build = codes = rebuild = write = read = (Sample) { UINT64_MAX, 0 };
+
+        if (r == rounds && ok) {
+            uint64_t bits = blocks * BLOCK * BYTE;
+            report(shape->name, "enqueue+dequeue", pq, 2 * (uint64_t) unique, 0);
+            report(shape->name, "build_tree", build, BATCH, 0);
+            report(shape->name, "build_codes", codes, BATCH, 0);
+            report(shape->name, "rebuild_tree", rebuild, BATCH, 0);
+            report(shape->name, "write_code+flush", write, nsyms, nsyms);
+            report(shape->name, "read_bit", read, bits, bits / BYTE);
+        }
+    }
+
+    pq_delete(&q);
+    close(fd);
+    delete_tree(&root);
+    for (uint16_t i = 0; i < unique; i++)
+        node_delete(&nodes[i]);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hn:s:";
+    uint32_t rounds = 7;
+    uint64_t nsyms = 1 << 20;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+        case 'n': rounds = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 's': nsyms = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    if (rounds == 0 || nsyms == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    kernels_init(NULL);
+
+    static Shape shapes[4];
+    uint8_t *syms = (uint8_t *) malloc(nsyms);
+    if (!syms) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+    make_shapes(shapes);
+
+    printf("%-10s %-20s %12s %12s\n", "histogram", "benchmark", "ns/op", "bytes/cycle");
+    bool ok = true;
+    for (uint32_t i = 0; ok && i < 4; i++) {
+        draw(shapes[i].hist, syms, nsyms);
+        ok = bench_shape(&shapes[i], rounds, syms, nsyms);
+    }
+
+    free(syms);
+    if (!ok) {
+        fprintf(stderr, "Error: Cannot set up a benchmark.\n");
+        return -1;
+    }
+    return 0;
+}
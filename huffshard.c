@@ -0,0 +1,93 @@
+#include "defines.h"
+#include "kernels.h"
+#include "split.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  Splits a file into shards that can be compressed apart (encode -b) and concatenated.\n"
+        "  Shards end where encode -b would start a new block anyway, so the concatenation is\n"
+        "  about as small as compressing the whole file. Prints a line per shard:\n"
+        "  index offset length.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-n shards] [-z size] -i infile\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -n shards      Number of shards of about equal size (default: 1).\n"
+        "  -z size        Bytes per shard instead (shards end at the first block past size).\n"
+        "  -i infile      Input file to split.\n",
+        argv);
+
+    return;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    char *optlist = "hn:z:i:";
+    uint64_t shards = 1, shard_size = 0;
+    int infile = -1;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+        case 'n': shards = strtoull(optarg, NULL, 10); break;
+        case 'z': shard_size = strtoull(optarg, NULL, 10); break;
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (infile == -1) {
+                fprintf(stderr, "Error: Cannot open input file.\n");
+                return -1;
+            }
+            break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    /* shards are cut from a file, so they can be read again by offset */
+    if (infile == -1 || shards == 0) {
+        usage(argv[0]);
+        if (infile != -1)
+            close(infile);
+        return -1;
+    }
+    kernels_init(NULL);
+
+    uint64_t hist[ALPHABET] = { 0 };
+    uint32_t nsegs = 0;
+    Segment *segs = split_input(infile, infile, hist, &nsegs);
+    close(infile);
+    if (!segs) {
+        fprintf(stderr, "Failed to split input into blocks.\n");
+        return -1;
+    }
+
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < nsegs; i++)
+        size += segs[i].size;
+
+    /* whole segments go to a shard till it reaches its share of the input. shares are counted
+     * from the start of the file so rounding does not pile up in the last shard */
+    uint64_t share = size / shards + (size % shards != 0), start = 0, index = 0;
+    for (uint32_t i = 0; i < nsegs; i++) {
+        uint64_t end = segs[i].offset + segs[i].size;
+        bool full = shard_size ? end - start >= shard_size : end >= share * (index + 1);
+        if (full || i + 1 == nsegs) {
+            printf("%" PRIu64 " %" PRIu64 " %" PRIu64 "\n", index++, start, end - start);
+            start = end;
+        }
+    }
+
+    free(segs);
+    return 0;
+}
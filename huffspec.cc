@@ -0,0 +1,182 @@
+#include "defines.h"
+#include "huffman.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_LEN 11 // longest code of the coders (a 2048 entry decode table)
+
+/* helper function to print usage (credits: idea from error c file in lab5) */
+static void usage(char *argv) {
+    fprintf(stderr,
+        "SYNOPSIS\n"
+        "  Times the c++ coders of huffman.hpp on a file: coders specialized at compile time on\n"
+        "  a fixed english text distribution (1 and 4 streams), a coder made at run time from\n"
+        "  the file's own histogram and the in memory codec. Checks every round trip.\n"
+        "\n"
+        "USAGE\n"
+        "  ./%s [-h] [-n rounds] -i infile\n"
+        "\n"
+        "OPTIONS\n"
+        "  -h             Program usage and help.\n"
+        "  -n rounds      Timed rounds of each coder, fastest kept (default: 5).\n"
+        "  -i infile      Input file to code.\n",
+        argv);
+
+    return;
+}
+
+/* the fixed distribution: letter frequencies of english text (per 10000) for the lower case
+ * letters, a tenth of them for the upper case ones, spaces, line ends and punctuation. every
+ * other byte is counted once so any input still codes */
+static constexpr std::array<uint64_t, ALPHABET> text_hist() {
+    constexpr uint64_t letters[26] = { 817, 149, 278, 425, 1270, 223, 202, 609, 697, 15, 77, 403,
+        241, 675, 751, 193, 10, 599, 633, 906, 276, 98, 236, 15, 197, 7 };
+    std::array<uint64_t, ALPHABET> hist {};
+    for (size_t s = 0; s < ALPHABET; s++)
+        hist[s] = 1;
+    for (size_t l = 0; l < 26; l++) {
+        hist['a' + l] = 10 * letters[l];
+        hist['A' + l] = letters[l];
+    }
+    for (size_t d = 0; d < 10; d++)
+        hist['0' + d] = 300;
+    hist[' '] = 20000;
+    hist['\n'] = 2000;
+    hist['.'] = 1000;
+    hist[','] = 1200;
+    return hist;
+}
+
+static constexpr std::array<uint64_t, ALPHABET> TEXT = text_hist();
+static constexpr huff::Coder<uint8_t, MAX_LEN, 1> text1(TEXT);
+static constexpr huff::Coder<uint8_t, MAX_LEN, 4> text4(TEXT);
+
+/* helper function to get a monotonic time in ns */
+static uint64_t now_ns(void) {
+    return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/* helper function to print one result */
+static void report(const char *name, uint64_t size, uint64_t coded, uint64_t enc, uint64_t dec) {
+    printf("%-14s %12" PRIu64 " %8.3lf %12.1lf %12.1lf\n", name, coded,
+        size ? (double) coded / size : 0.0, enc ? size * 1e3 / enc : 0.0,
+        dec ? size * 1e3 / dec : 0.0);
+    return;
+}
+
+/* times coder on in. returns false if a round trip fails */
+template <typename C>
+static bool bench(const char *name, const C &coder, const std::vector<uint8_t> &in,
+    uint32_t rounds) {
+    std::vector<uint8_t> coded(in.size() * MAX_LEN / 8 + C::HEADER + huff::SLACK + 1);
+    std::vector<uint8_t> back(in.size());
+    uint64_t enc = UINT64_MAX, dec = UINT64_MAX, size = 0;
+
+    for (uint32_t r = 0; r < rounds; r++) {
+        uint64_t t = now_ns();
+        size = coder.encode(in.data(), in.size(), coded.data(), coded.size() - huff::SLACK);
+        enc = std::min(enc, now_ns() - t);
+        if (size == 0)
+            return false;
+
+        t = now_ns();
+        bool ok = coder.decode(coded.data(), size, back.data(), back.size());
+        dec = std::min(dec, now_ns() - t);
+        if (!ok || back != in)
+            return false;
+    }
+    report(name, in.size(), size, enc, dec);
+    return true;
+}
+
+/* times the in memory codec on in. returns false if a round trip fails */
+static bool bench_codec(const std::vector<uint8_t> &in, uint32_t rounds) {
+    huff::Codec codec;
+    uint64_t enc = UINT64_MAX, dec = UINT64_MAX, size = 0;
+
+    for (uint32_t r = 0; codec && r < rounds; r++) {
+        uint64_t t = now_ns();
+        auto coded = codec.compress(in);
+        enc = std::min(enc, now_ns() - t);
+        if (!coded)
+            return false;
+        size = coded->size();
+
+        t = now_ns();
+        auto back = codec.decompress(*coded);
+        dec = std::min(dec, now_ns() - t);
+        if (!back || *back != in)
+            return false;
+    }
+    report("codec", in.size(), size, enc, dec);
+    return (bool) codec;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    const char *optlist = "hn:i:";
+    uint32_t rounds = 5;
+    int infile = -1;
+
+    while ((c = getopt(argc, argv, optlist)) != -1) {
+        switch (c) {
+        case 'h': usage(argv[0]); return 0;
+        case 'n': rounds = (uint32_t) strtoul(optarg, NULL, 10); break;
+        case 'i':
+            infile = open(optarg, O_RDONLY);
+            if (infile == -1) {
+                fprintf(stderr, "Error: Cannot open input file.\n");
+                return -1;
+            }
+            break;
+        default: usage(argv[0]); return -1;
+        }
+    }
+
+    struct stat st;
+    if (infile == -1 || rounds == 0 || fstat(infile, &st) != 0 || !S_ISREG(st.st_mode)) {
+        usage(argv[0]);
+        if (infile != -1)
+            close(infile);
+        return -1;
+    }
+    huff::init();
+
+    std::vector<uint8_t> in((size_t) st.st_size);
+    size_t got = 0;
+    for (ssize_t n = 1; got < in.size() && n > 0; got += n > 0 ? (size_t) n : 0)
+        n = read(infile, in.data() + got, in.size() - got);
+    close(infile);
+    if (got != in.size()) {
+        fprintf(stderr, "Error: Cannot read input file.\n");
+        return -1;
+    }
+
+    /* the file's own distribution, with its tables built at run time */
+    std::array<uint64_t, ALPHABET> hist {};
+    for (uint8_t b : in)
+        hist[b]++;
+    const huff::Coder<uint8_t, MAX_LEN, 4> own(hist);
+
+    printf("%-14s %12s %8s %12s %12s\n", "coder", "bytes", "ratio", "enc MB/s", "dec MB/s");
+    bool ok = bench("text x1", text1, in, rounds) && bench("text x4", text4, in, rounds)
+              && bench("own x4", own, in, rounds) && bench_codec(in, rounds);
+    if (!ok) {
+        fprintf(stderr, "Error: Round trip failed.\n");
+        return -1;
+    }
+    return 0;
+}
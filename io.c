@@ -1,24 +1,360 @@
+#define _GNU_SOURCE // O_DIRECT, sync_file_range, vmsplice and pipe sizes
+
 #include "io.h"
 
 #include "code.h"
 #include "defines.h"
+#include "kernels.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-#define BYTE 8
+#define BYTE         8
+#define DIRECT_FILES 2 // files that can go around the page cache at once (input and output)
 
 /* extern vars */
 uint64_t bytes_read = 0;
 uint64_t bytes_written = 0;
 
 /* array for buffer input or output */
-static uint8_t buffer[BLOCK] = { 0 }; // bufer that can hold 4096 bytes
+static uint8_t buffer[BLOCK + EMIT_SLACK] = { 0 }; // bufer that can hold 4096 bytes
 static uint16_t bufind = 0; // keeps track of index into buffer
 
+/* bits of packed codes not yet in buffer (they go at bufind, which is then byte aligned) */
+static uint64_t acc = 0;
+static uint32_t nacc = 0;
+
+/* a file read or written around the page cache. whole aligned spans go through buf with
+ * O_DIRECT. where the file system refuses it, plain transfers are made and the cache is dropped
+ * behind them (POSIX_FADV_DONTNEED) */
+typedef struct Direct {
+    bool used; // slot in use
+    bool output; // written (else read)
+    bool direct; // O_DIRECT is on
+    int fd;
+    uint8_t *buf; // DIRECT_SPAN bytes aligned to DIRECT_ALIGN
+    uint32_t len; // bytes staged to write, or read in
+    uint32_t pos; // bytes of buf handed out (input)
+    off_t base; // file offset of buf[0]
+} Direct;
+
+static Direct directs[DIRECT_FILES];
+
+/* a pipe written with vmsplice: output is decoded (or copied) into ring and its whole pages are
+ * queued in the pipe by reference, so the reader copies them out of ring instead of the kernel
+ * copying them in first. a page is written again only once more than the pipe holds was queued
+ * behind it (wrapping needs room for MAX_SEGMENT bytes and a carried page, so at least
+ * SPLICE_RING - 2 * (MAX_SEGMENT + page) >= SPLICE_PIPE bytes), by when it was read */
+typedef struct Spliced {
+    bool used; // fd goes through ring
+    bool retired; // vmsplice failed or the pipe grew: ring is left alone and fd written as usual
+    int fd;
+    uint32_t page; // bytes in a page
+    uint8_t *ring; // SPLICE_RING bytes mapped (freed memory could be reused while still queued)
+    uint32_t start; // first staged byte
+    uint32_t head; // end of the staged bytes
+} Spliced;
+
+static Spliced spliced;
+
+/* helper function to get the smaller of a and b */
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+    return a < b ? a : b;
+}
+
+/* helper function to find the Direct of fd. returns NULL if fd goes through the cache */
+static inline Direct *find_direct(int fd) {
+    for (uint32_t i = 0; i < DIRECT_FILES; i++)
+        if (directs[i].used && directs[i].fd == fd)
+            return &directs[i];
+    return NULL;
+}
+
+/* helper function to drop size bytes of fd at offset from the page cache (written ones are
+ * flushed first, since dirty pages cannot be dropped) */
+static void drop_cache(Direct *d, off_t offset, off_t size) {
+    if (d->output)
+        sync_file_range(d->fd, offset, size,
+            SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(d->fd, offset, size, POSIX_FADV_DONTNEED);
+    return;
+}
+
+/* helper function to move size bytes between buf and the file. a transfer O_DIRECT refuses
+ * (unaligned, or a file system without it) turns O_DIRECT off and is made again */
+static ssize_t direct_transfer(Direct *d, uint8_t *buf, size_t size) {
+    ssize_t n = d->output ? write(d->fd, buf, size) : read(d->fd, buf, size);
+    if (n == -1 && errno == EINVAL && d->direct) {
+        d->direct = false;
+        fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) & ~O_DIRECT);
+        n = d->output ? write(d->fd, buf, size) : read(d->fd, buf, size);
+    }
+    if (n > 0 && !d->direct)
+        drop_cache(d, d->base, n);
+    return n;
+}
+
+/* routes fd (a regular file, at an aligned offset) around the page cache: reads and writes
+ * through read_bytes and write_bytes are staged DIRECT_SPAN bytes at a time with O_DIRECT.
+ * output must be finished with io_finish. returns false if fd is not a regular file (or out of
+ * memory), which leaves it alone */
+bool io_direct(int fd, bool output) {
+    struct stat st;
+    Direct *d = NULL;
+    for (uint32_t i = 0; !d && i < DIRECT_FILES; i++)
+        d = directs[i].used ? NULL : &directs[i];
+    if (!d || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    void *buf = NULL;
+    if (posix_memalign(&buf, DIRECT_ALIGN, DIRECT_SPAN) != 0)
+        return false;
+    *d = (Direct) { .used = true,
+        .output = output,
+        .direct = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == 0,
+        .fd = fd,
+        .buf = (uint8_t *) buf,
+        .len = 0,
+        .pos = 0,
+        .base = lseek(fd, 0, SEEK_CUR) };
+    return true;
+}
+
+/* seeks to offset from the start of fd, like lseek, for files read around the cache too.
+ * returns the offset or -1 */
+off_t io_seek(int fd, off_t offset) {
+    Direct *d = find_direct(fd);
+    if (!d || d->output)
+        return lseek(fd, offset, SEEK_SET);
+
+    /* in what was read in already. else read in from the aligned offset before it */
+    if (offset >= d->base && offset <= d->base + (off_t) d->len) {
+        d->pos = (uint32_t) (offset - d->base);
+        return offset;
+    }
+    off_t base = offset & ~(off_t) (DIRECT_ALIGN - 1);
+    if (lseek(fd, base, SEEK_SET) != base)
+        return -1;
+    d->base = base;
+    d->len = 0;
+    d->pos = 0;
+    if (offset > base) {
+        ssize_t got = direct_transfer(d, d->buf, DIRECT_SPAN);
+        d->len = got > 0 ? (uint32_t) got : 0;
+        d->pos = min_u32((uint32_t) (offset - base), d->len);
+    }
+    return offset;
+}
+
+/* helper function to write nbytes from buf to fd with write(). returns the bytes written */
+static int write_all(int fd, const uint8_t *buf, int nbytes) {
+    int remaining = nbytes; // all remaining
+    int write_ret = 1; // holds return value write syscall
+    int total_written = 0; // local count so that threads can write at the same time
+
+    /* still remaining and return val != EOF or error (>0) */
+    while (remaining != 0
+           && (write_ret = write(fd, buf, remaining)) > 0) { // try to write remaining
+        remaining -= write_ret; // reduce remaining by how many write
+        total_written += write_ret; // update total bytes write
+        buf += write_ret; // update the pointer (buf for next write)
+    }
+
+    return total_written;
+}
+
+/* routes writes to fd (a pipe) through vmsplice, growing the pipe to SPLICE_PIPE if it can.
+ * the reader has to copy what it takes out of the pipe (read), not move it on by reference
+ * (splice or tee), since the pages it gets are written again later. output must be finished
+ * with io_finish. returns false if fd is not a pipe (or out of memory), which leaves it alone */
+bool io_splice(int fd) {
+    struct stat st;
+    if (spliced.used || fstat(fd, &st) != 0 || !S_ISFIFO(st.st_mode))
+        return false;
+
+    fcntl(fd, F_SETPIPE_SZ, SPLICE_PIPE); // the default 64KB pipe wakes the reader too often
+    int cap = fcntl(fd, F_GETPIPE_SZ);
+    void *ring = cap > 0 && cap <= SPLICE_PIPE
+                     ? mmap(NULL, SPLICE_RING, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                         -1, 0)
+                     : MAP_FAILED;
+    if (ring == MAP_FAILED)
+        return false;
+
+    spliced = (Spliced) { .used = true,
+        .retired = false,
+        .fd = fd,
+        .page = (uint32_t) sysconf(_SC_PAGESIZE),
+        .ring = (uint8_t *) ring,
+        .start = 0,
+        .head = 0 };
+    return true;
+}
+
+/* helper function to find the Spliced of fd. returns NULL if fd is written as usual */
+static inline Spliced *find_spliced(int fd) {
+    return spliced.used && !spliced.retired && spliced.fd == fd ? &spliced : NULL;
+}
+
+/* helper function to queue size staged bytes in the pipe. if the pipe grew past SPLICE_PIPE
+ * (its reader can resize it) or vmsplice fails, everything staged is written with write() and
+ * the ring is retired. returns false if the bytes could not be written */
+static bool splice_out(Spliced *s, uint32_t size) {
+    while (size > 0 && !s->retired) {
+        int cap = fcntl(s->fd, F_GETPIPE_SZ);
+        struct iovec iov = { .iov_base = s->ring + s->start, .iov_len = size };
+        ssize_t n = cap > 0 && cap <= SPLICE_PIPE ? vmsplice(s->fd, &iov, 1, 0) : -1;
+        if (n > 0) {
+            s->start += (uint32_t) n;
+            size -= (uint32_t) n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else {
+            s->retired = true;
+        }
+    }
+
+    /* no more vmsplice. what is staged is copied in */
+    if (s->retired) {
+        uint32_t staged = s->head - s->start;
+        bool ok = write_all(s->fd, s->ring + s->start, (int) staged) == (int) staged;
+        s->start = s->head;
+        return ok;
+    }
+    return true;
+}
+
+/* returns a place for size bytes (at most MAX_SEGMENT) to be written to fd by io_commit, which
+ * saves copying them. returns NULL if fd does not go through io_splice (use write_bytes) */
+uint8_t *io_window(int fd, uint32_t size) {
+    Spliced *s = find_spliced(fd);
+    if (!s || size > MAX_SEGMENT)
+        return NULL;
+
+    /* no room before the end of the ring. queue the whole pages and carry the partial one to
+     * the front */
+    if (s->head + size > SPLICE_RING) {
+        if (!splice_out(s, (s->head - s->start) / s->page * s->page) || s->retired)
+            return NULL;
+        uint32_t tail = s->head - s->start;
+        memmove(s->ring, s->ring + s->start, tail);
+        s->start = 0;
+        s->head = tail;
+    }
+    return s->ring + s->head;
+}
+
+/* writes the first size bytes of the window io_window gave for fd. returns false on error */
+bool io_commit(int fd, uint32_t size) {
+    Spliced *s = find_spliced(fd);
+    if (!s)
+        return false;
+    s->head += size;
+    if (s->head - s->start < SPLICE_BATCH)
+        return true;
+    return splice_out(s, (s->head - s->start) / s->page * s->page);
+}
+
+/* helper function to write nbytes for a Spliced output (copied into the ring). returns the
+ * bytes taken */
+static int splice_write(Spliced *s, const uint8_t *buf, int nbytes) {
+    int total = 0;
+    while (total < nbytes) {
+        uint32_t n = min_u32(MAX_SEGMENT, (uint32_t) (nbytes - total));
+        uint8_t *dst = io_window(s->fd, n);
+        if (!dst)
+            return total + write_all(s->fd, buf + total, nbytes - total); // ring retired
+        memcpy(dst, buf + total, n);
+        if (!io_commit(s->fd, n))
+            return total;
+        total += (int) n;
+    }
+    return total;
+}
+
+/* queues what is staged for fd now if it goes through io_splice (for a reader waiting on a
+ * flushed stream). returns false if it could not be written */
+bool io_flush(int fd) {
+    Spliced *s = find_spliced(fd);
+    return s ? splice_out(s, s->head - s->start) : true;
+}
+
+/* writes out what is staged for fd (the unaligned tail without O_DIRECT, or what is left for
+ * vmsplice) and drops fd from the cache. returns false if the tail could not be written */
+bool io_finish(int fd) {
+    if (spliced.used && spliced.fd == fd) {
+        bool ok = splice_out(&spliced, spliced.head - spliced.start);
+        munmap(spliced.ring, SPLICE_RING); // pages still queued stay with the pipe
+        spliced.used = false;
+        return ok;
+    }
+
+    Direct *d = find_direct(fd);
+    if (!d)
+        return true;
+
+    bool ok = true;
+    if (d->output && d->len > 0) {
+        if (d->direct && d->len % DIRECT_ALIGN != 0) {
+            d->direct = false;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        }
+        ok = direct_transfer(d, d->buf, d->len) == (ssize_t) d->len;
+    }
+    drop_cache(d, 0, 0); // 0 length is to the end of the file
+    free(d->buf);
+    d->used = false;
+    return ok;
+}
+
+/* helper function to read nbytes for a Direct input */
+static int direct_read(Direct *d, uint8_t *buf, int nbytes) {
+    int total = 0;
+    while (total < nbytes) {
+        if (d->pos == d->len) {
+            d->base += d->len;
+            d->pos = 0;
+            ssize_t got = direct_transfer(d, d->buf, DIRECT_SPAN);
+            d->len = got > 0 ? (uint32_t) got : 0;
+            if (d->len == 0)
+                break; // EOF or error
+        }
+        uint32_t n = min_u32(d->len - d->pos, (uint32_t) (nbytes - total));
+        memcpy(buf + total, d->buf + d->pos, n);
+        d->pos += n;
+        total += (int) n;
+    }
+    return total;
+}
+
+/* helper function to write nbytes for a Direct output. returns the bytes taken */
+static int direct_write(Direct *d, const uint8_t *buf, int nbytes) {
+    int total = 0;
+    while (total < nbytes) {
+        uint32_t n = min_u32(DIRECT_SPAN - d->len, (uint32_t) (nbytes - total));
+        memcpy(d->buf + d->len, buf + total, n);
+        d->len += n;
+        total += (int) n;
+        if (d->len == DIRECT_SPAN) {
+            if (direct_transfer(d, d->buf, DIRECT_SPAN) != DIRECT_SPAN)
+                return total - (int) n;
+            d->base += DIRECT_SPAN;
+            d->len = 0;
+        }
+    }
+    return total;
+}
+
 /* helper function to set the bit at ind in buf (based on bv in lab5) */
 static void set_bit(uint8_t *buf, uint16_t ind) {
     buf[ind / BYTE] |= ((uint8_t) 1 << (ind % BYTE));
@@ -38,40 +374,53 @@ static uint8_t get_bit(uint8_t *buf, uint16_t ind) {
 
 /* reads nbytes from infile into buffer buf */
 int read_bytes(int infile, uint8_t *buf, int nbytes) {
+    Direct *d = find_direct(infile);
+    if (d)
+        return direct_read(d, buf, nbytes);
+
     int remaining = nbytes; // all remaining
     int read_ret = 1; // holds return value of read syscall
+    int total_read = 0; // local count so that threads can read at the same time
 
     /* still remaining and return val != EOF or error (>0) */
     while (
         remaining != 0 && (read_ret = read(infile, buf, remaining)) > 0) { // try to read remaining
         remaining -= read_ret; // reduce remaining by how many read
-        bytes_read += read_ret; // update total bytes read
+        total_read += read_ret; // update total bytes read
         buf += read_ret; // update the pointer (buf for next read)
     }
 
-    uint64_t total_read = bytes_read;
-    bytes_read = 0; // reset for next call
-
     return total_read;
 }
 
+/* reads up to nbytes of what infile has within timeout ms (-1 to wait till something comes),
+ * for input coded as it arrives. returns the bytes read, 0 at EOF (or on error) or -1 if
+ * nothing came in time */
+int read_within(int infile, uint8_t *buf, int nbytes, int timeout) {
+    Direct *d = find_direct(infile);
+    if (d)
+        return direct_read(d, buf, nbytes); // a regular file has it all
+
+    struct pollfd p = { .fd = infile, .events = POLLIN, .revents = 0 };
+    int ready = poll(&p, 1, timeout);
+    if (ready == 0 || (ready == -1 && errno == EINTR))
+        return -1;
+
+    ssize_t n;
+    while ((n = read(infile, buf, nbytes)) == -1 && errno == EINTR)
+        ;
+    return n > 0 ? (int) n : 0;
+}
+
 /* writes nbytes from buf to outfile */
 int write_bytes(int outfile, uint8_t *buf, int nbytes) {
-    int remaining = nbytes; // all remaining
-    int write_ret = 1; // holds return value write syscall
-
-    /* still remaining and return val != EOF or error (>0) */
-    while (remaining != 0
-           && (write_ret = write(outfile, buf, remaining)) > 0) { // try to write remaining
-        remaining -= write_ret; // reduce remaining by how many write
-        bytes_written += write_ret; // update total bytes write
-        buf += write_ret; // update the pointer (buf for next write)
-    }
-
-    uint64_t total_written = bytes_written;
-    bytes_written = 0; // reset for next call
-
-    return total_written;
+    Direct *d = find_direct(outfile);
+    if (d)
+        return direct_write(d, buf, nbytes);
+    Spliced *s = find_spliced(outfile);
+    if (s)
+        return splice_write(s, buf, nbytes);
+    return write_all(outfile, buf, nbytes);
 }
 
 /* reads one bit out of a buffer */
@@ -97,8 +446,22 @@ bool read_bit(int infile, uint8_t *bit) {
     return bufind < bytes_read * 8; // more to read if bits read are < bytesread*8 (total bits read)
 }
 
+/* helper function to move the bits held by write_symbols into buffer one at a time */
+static void drain_packed(void) {
+    for (; nacc > 0; nacc--, acc >>= 1) {
+        if (acc & 1)
+            set_bit(buffer, bufind);
+        else
+            clr_bit(buffer, bufind);
+        bufind++; // never fills the buffer: fewer than BYTE bits are held
+    }
+    return;
+}
+
 /* writes a code to outfile */
 void write_code(int outfile, Code *c) {
+    drain_packed(); // packed codes written before this one come first
+
     for (uint32_t i = 0; i < c->top; i++) {
         /* set or clear (based on the value in code) bit in buffer */
         if (get_bit(c->bits, (uint16_t) i))
@@ -118,13 +481,50 @@ void write_code(int outfile, Code *c) {
     return;
 }
 
+/* writes the packed codes for size bytes of in to outfile (emitted a word at a time) */
+void write_symbols(
+    int outfile, PackedCode table[static ALPHABET], const uint8_t *in, uint64_t size) {
+
+    /* write_code left a partial byte. take it back into the accumulator */
+    if (nacc == 0 && bufind % BYTE != 0) {
+        nacc = bufind % BYTE;
+        bufind -= nacc;
+        acc = buffer[bufind / BYTE] & ((1u << nacc) - 1);
+    }
+
+    while (size > 0) {
+        /* no code completes more than a word */
+        uint64_t room = (BLOCK - bufind / BYTE) / sizeof(uint64_t);
+
+        /* buffer (almost) full. write out the whole bytes */
+        if (room == 0) {
+            write_bytes(outfile, buffer, bufind / BYTE);
+            bufind = 0; // reset index
+            continue;
+        }
+
+        uint64_t n = size < room ? size : room;
+        bufind += BYTE * kernels->emit(table, in, n, buffer + bufind / BYTE, &acc, &nacc);
+        in += n;
+        size -= n;
+    }
+
+    /* write_code expects room for at least one bit */
+    if (bufind == BLOCK * BYTE) {
+        write_bytes(outfile, buffer, BLOCK);
+        bufind = 0;
+    }
+
+    return;
+}
+
 /* flushes any remaining code in the buffer */
 void flush_codes(int outfile) {
+    drain_packed(); // packed codes still in the accumulator
 
     /* still bytes left */
     if (bufind != 0) {
-        uint16_t min_bytes
-            = (bufind / BYTE) == 0 ? 1 : (bufind / BYTE) + 1; // minimum bytes to be written
+        uint16_t min_bytes = (bufind + BYTE - 1) / BYTE; // minimum bytes to be written
 
         /* zero out remaining bits before writing */
         for (uint16_t i = bufind; i < min_bytes * 8; i++) {
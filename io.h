@@ -2,21 +2,48 @@
 #define __IO_H__
 
 #include "code.h"
+#include "defines.h"
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#define DIRECT_ALIGN 4096 // alignment of O_DIRECT buffers, offsets and sizes
+#define DIRECT_SPAN  (1 << 20) // bytes moved per O_DIRECT read or write
+#define SPLICE_PIPE  (1 << 20) // pipe size asked for by io_splice (the most a user gets)
+#define SPLICE_RING  (4 * SPLICE_PIPE) // bytes of output staged for vmsplice
+#define SPLICE_BATCH (1 << 16) // staged bytes queued in the pipe at once
 
 extern uint64_t bytes_read;
 extern uint64_t bytes_written;
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
+int read_within(int infile, uint8_t *buf, int nbytes, int timeout);
+
 int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
 bool read_bit(int infile, uint8_t *bit);
 
 void write_code(int outfile, Code *c);
 
+void write_symbols(
+    int outfile, PackedCode table[static ALPHABET], const uint8_t *in, uint64_t size);
+
 void flush_codes(int outfile);
 
+bool io_direct(int fd, bool output);
+
+bool io_splice(int fd);
+
+uint8_t *io_window(int fd, uint32_t size);
+
+bool io_commit(int fd, uint32_t size);
+
+bool io_flush(int fd);
+
+off_t io_seek(int fd, off_t offset);
+
+bool io_finish(int fd);
+
 #endif
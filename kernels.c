@@ -0,0 +1,372 @@
+#include "kernels.h"
+
+#include "code.h"
+#include "defines.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define X86 1
+#else
+#define X86 0
+#endif
+
+#define BYTE        8
+#define HIST_TABLES 4 // counts are spread over tables so that repeated bytes do not stall
+#define HIST_SPAN   (1ULL << 30) // bytes counted before the 32-bit counts are merged
+#define CRC32C_POLY 0x82f63b78 // reversed castagnoli polynomial
+#define INLINE      static inline __attribute__((always_inline))
+
+typedef uint32_t Counts[HIST_TABLES][ALPHABET];
+
+static const char *names[KERNEL_LEVELS] = { "scalar", "sse4.2", "bmi2" };
+
+/* byte counting shared by every level (inlined into each so it is compiled for its target) */
+INLINE void count_bytes(Counts c, const uint8_t *in, uint64_t size) {
+    uint64_t i = 0;
+
+    /* a word at a time, its bytes going to alternating tables */
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, in + i, sizeof(w));
+        for (uint32_t b = 0; b < sizeof(w); b++)
+            c[b % HIST_TABLES][(w >> (b * BYTE)) & 0xff]++;
+    }
+    for (; i < size; i++)
+        c[0][in[i]]++;
+    return;
+}
+
+/* helper function to add counts to hist (and zero them for the next span) */
+INLINE void merge_counts(Counts c, uint64_t hist[static ALPHABET]) {
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        for (uint16_t t = 0; t < HIST_TABLES; t++)
+            hist[i] += c[t][i];
+    memset(c, 0, sizeof(Counts));
+    return;
+}
+
+/* codes appended with a shift and an or. a whole word is stored every code and the pointer
+ * moves on by the bytes completed. nacc < 8 and codes of at most PACKED_MAX bits fit in acc */
+INLINE uint64_t emit_codes(const PackedCode table[static ALPHABET], const uint8_t *in,
+    uint64_t size, uint8_t *out, uint64_t *acc, uint32_t *nacc) {
+    uint64_t a = *acc;
+    uint32_t n = *nacc;
+    uint8_t *dst = out;
+
+    for (uint64_t i = 0; i < size; i++) {
+        PackedCode p = table[in[i]];
+        a |= packed_bits(p) << n;
+        n += packed_len(p);
+
+        memcpy(dst, &a, sizeof(a)); // little endian: first bit is the lsb of the first byte
+        uint32_t whole = n / BYTE;
+        dst += whole;
+        a = whole == sizeof(a) ? 0 : a >> (whole * BYTE);
+        n -= whole * BYTE;
+    }
+
+    *acc = a;
+    *nacc = n;
+    return (uint64_t) (dst - out);
+}
+
+/* helper function to find where every byte plane starts in out */
+INLINE void plane_starts(uint64_t size, uint8_t n, uint8_t *out, uint8_t *plane[static n]) {
+    for (uint8_t p = 0; p < n; p++) {
+        plane[p] = out;
+        out += plane_size(size, n, p);
+    }
+    return;
+}
+
+/* byte planes one element at a time, from element from (the vector levels do the start) */
+INLINE void shuffle_from(
+    const uint8_t *in, uint64_t size, uint8_t n, uint8_t *plane[static n], uint64_t from) {
+    for (uint64_t i = from; i * n < size; i++)
+        for (uint8_t p = 0; p < n && i * n + p < size; p++)
+            plane[p][i] = in[i * n + p];
+    return;
+}
+
+/* the inverse of shuffle_from */
+INLINE void unshuffle_from(
+    uint8_t *const plane[static 1], uint64_t size, uint8_t n, uint8_t *out, uint64_t from) {
+    for (uint64_t i = from; i * n < size; i++)
+        for (uint8_t p = 0; p < n && i * n + p < size; p++)
+            out[i * n + p] = plane[p][i];
+    return;
+}
+
+/* scalar */
+
+static void histogram_scalar(const uint8_t *in, uint64_t size, uint64_t hist[static ALPHABET]) {
+    Counts c = { { 0 } };
+    for (uint64_t off = 0; off < size; off += HIST_SPAN) {
+        count_bytes(c, in + off, size - off < HIST_SPAN ? size - off : HIST_SPAN);
+        merge_counts(c, hist);
+    }
+    return;
+}
+
+static uint64_t emit_scalar(const PackedCode table[static ALPHABET], const uint8_t *in,
+    uint64_t size, uint8_t *out, uint64_t *acc, uint32_t *nacc) {
+    return emit_codes(table, in, size, out, acc, nacc);
+}
+
+static uint32_t crc_table[ALPHABET];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+/* helper function to fill the byte at a time crc table */
+static void crc_init(void) {
+    for (uint32_t i = 0; i < ALPHABET; i++) {
+        uint32_t r = i;
+        for (uint8_t b = 0; b < BYTE; b++)
+            r = r & 1 ? (r >> 1) ^ CRC32C_POLY : r >> 1;
+        crc_table[i] = r;
+    }
+    return;
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *buf, uint64_t size) {
+    pthread_once(&crc_once, crc_init);
+    crc = ~crc;
+    for (uint64_t i = 0; i < size; i++)
+        crc = crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> BYTE);
+    return ~crc;
+}
+
+static void shuffle_scalar(const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out) {
+    uint8_t *plane[PLANES_MAX];
+    plane_starts(size, n, out, plane);
+    shuffle_from(in, size, n, plane, 0);
+    return;
+}
+
+static void unshuffle_scalar(const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out) {
+    uint8_t *plane[PLANES_MAX];
+    plane_starts(size, n, (uint8_t *) in, plane);
+    unshuffle_from(plane, size, n, out, 0);
+    return;
+}
+
+#if X86
+
+/* sse4.2: runs of a byte found 16 bytes at a time, crc32 instruction, byte shuffles and unpacks
+ * for 2 and 4 byte elements */
+
+__attribute__((target("sse4.2"))) static void histogram_sse42(
+    const uint8_t *in, uint64_t size, uint64_t hist[static ALPHABET]) {
+    Counts c = { { 0 } };
+
+    for (uint64_t off = 0; off < size; off += HIST_SPAN) {
+        uint64_t n = size - off < HIST_SPAN ? size - off : HIST_SPAN, i = 0, start = 0;
+        const uint8_t *p = in + off;
+
+        /* a vector of one repeated byte is counted at once. the rest go to count_bytes */
+        for (; i + sizeof(__m128i) <= n; i += sizeof(__m128i)) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8((char) p[i]))) == 0xffff) {
+                count_bytes(c, p + start, i - start);
+                c[0][p[i]] += sizeof(__m128i);
+                start = i + sizeof(__m128i);
+            }
+        }
+        count_bytes(c, p + start, n - start);
+        merge_counts(c, hist);
+    }
+    return;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(
+    uint32_t crc, const uint8_t *buf, uint64_t size) {
+    uint64_t r = ~crc, i = 0;
+
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t w;
+        memcpy(&w, buf + i, sizeof(w));
+        r = _mm_crc32_u64(r, w);
+    }
+    for (; i < size; i++)
+        r = _mm_crc32_u8((uint32_t) r, buf[i]);
+    return ~(uint32_t) r;
+}
+
+__attribute__((target("sse4.2"))) static void shuffle_sse42(
+    const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out) {
+    uint8_t *plane[PLANES_MAX];
+    uint64_t i = 0; // elements done
+    plane_starts(size, n, out, plane);
+
+    /* gather byte p of every element of a vector together, then store each plane's part */
+    if (n == 2) {
+        __m128i mask = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+        for (; (i + 8) * 2 <= size; i += 8) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + i * 2)), mask);
+            _mm_storel_epi64((__m128i *) (plane[0] + i), v);
+            _mm_storel_epi64((__m128i *) (plane[1] + i), _mm_srli_si128(v, 8));
+        }
+    } else if (n == 4) {
+        __m128i mask = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        for (; (i + 4) * 4 <= size; i += 4) {
+            __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (in + i * 4)), mask);
+            uint32_t w[4];
+            _mm_storeu_si128((__m128i *) w, v);
+            for (uint8_t p = 0; p < 4; p++)
+                memcpy(plane[p] + i, &w[p], sizeof(w[p]));
+        }
+    }
+
+    shuffle_from(in, size, n, plane, i);
+    return;
+}
+
+__attribute__((target("sse4.2"))) static void unshuffle_sse42(
+    const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out) {
+    uint8_t *plane[PLANES_MAX];
+    uint64_t i = 0;
+    plane_starts(size, n, (uint8_t *) in, plane);
+
+    /* interleave the planes back with byte (and word) unpacks */
+    if (n == 2) {
+        for (; (i + 16) * 2 <= size; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (plane[0] + i));
+            __m128i b = _mm_loadu_si128((const __m128i *) (plane[1] + i));
+            _mm_storeu_si128((__m128i *) (out + i * 2), _mm_unpacklo_epi8(a, b));
+            _mm_storeu_si128((__m128i *) (out + i * 2 + 16), _mm_unpackhi_epi8(a, b));
+        }
+    } else if (n == 4) {
+        for (; (i + 4) * 4 <= size; i += 4) {
+            uint32_t w[4];
+            for (uint8_t p = 0; p < 4; p++)
+                memcpy(&w[p], plane[p] + i, sizeof(w[p]));
+            __m128i a = _mm_cvtsi32_si128((int) w[0]), b = _mm_cvtsi32_si128((int) w[1]);
+            __m128i c = _mm_cvtsi32_si128((int) w[2]), d = _mm_cvtsi32_si128((int) w[3]);
+            __m128i ab = _mm_unpacklo_epi8(a, b), cd = _mm_unpacklo_epi8(c, d);
+            _mm_storeu_si128((__m128i *) (out + i * 4), _mm_unpacklo_epi16(ab, cd));
+        }
+    }
+
+    unshuffle_from(plane, size, n, out, i);
+    return;
+}
+
+/* bmi2: bmi2 shifts for emission (still the scalar loop), avx2 runs found 32 bytes at a time
+ * and lane crossing shuffles */
+
+__attribute__((target("avx2,bmi,bmi2"))) static void histogram_avx2(
+    const uint8_t *in, uint64_t size, uint64_t hist[static ALPHABET]) {
+    Counts c = { { 0 } };
+
+    for (uint64_t off = 0; off < size; off += HIST_SPAN) {
+        uint64_t n = size - off < HIST_SPAN ? size - off : HIST_SPAN, i = 0, start = 0;
+        const uint8_t *p = in + off;
+
+        for (; i + sizeof(__m256i) <= n; i += sizeof(__m256i)) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+            if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8((char) p[i]))) == -1) {
+                count_bytes(c, p + start, i - start);
+                c[0][p[i]] += sizeof(__m256i);
+                start = i + sizeof(__m256i);
+            }
+        }
+        count_bytes(c, p + start, n - start);
+        merge_counts(c, hist);
+    }
+    return;
+}
+
+__attribute__((target("avx2,bmi,bmi2"))) static uint64_t emit_bmi2(
+    const PackedCode table[static ALPHABET], const uint8_t *in, uint64_t size, uint8_t *out,
+    uint64_t *acc, uint32_t *nacc) {
+    return emit_codes(table, in, size, out, acc, nacc);
+}
+
+__attribute__((target("avx2,bmi,bmi2"))) static void shuffle_avx2(
+    const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out) {
+    uint8_t *plane[PLANES_MAX];
+    uint64_t i = 0;
+    plane_starts(size, n, out, plane);
+
+    /* gather within each 16-byte lane, then move the pieces of a plane next to each other */
+    if (n == 2) {
+        __m256i mask = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15, 0, 2,
+            4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+        for (; (i + 16) * 2 <= size; i += 16) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (in + i * 2));
+            v = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, mask), 0xd8);
+            _mm_storeu_si128((__m128i *) (plane[0] + i), _mm256_castsi256_si128(v));
+            _mm_storeu_si128((__m128i *) (plane[1] + i), _mm256_extracti128_si256(v, 1));
+        }
+    } else if (n == 4) {
+        __m256i mask = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15, 0, 4,
+            8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+        __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        for (; (i + 8) * 4 <= size; i += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (in + i * 4));
+            v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, mask), order);
+            uint64_t w[4];
+            _mm256_storeu_si256((__m256i *) w, v);
+            for (uint8_t p = 0; p < 4; p++)
+                memcpy(plane[p] + i, &w[p], sizeof(w[p]));
+        }
+    }
+
+    shuffle_from(in, size, n, plane, i);
+    return;
+}
+
+#endif
+
+/* every level. a kernel an instruction set does nothing for is the one of the level below */
+static const Kernels levels[KERNEL_LEVELS] = {
+    { KERNEL_SCALAR, histogram_scalar, emit_scalar, crc32c_scalar, shuffle_scalar,
+        unshuffle_scalar },
+#if X86
+    { KERNEL_SSE42, histogram_sse42, emit_scalar, crc32c_sse42, shuffle_sse42, unshuffle_sse42 },
+    { KERNEL_BMI2, histogram_avx2, emit_bmi2, crc32c_sse42, shuffle_avx2, unshuffle_sse42 },
+#endif
+};
+
+/* scalar until kernels_init() picks a level */
+const Kernels *kernels = &levels[KERNEL_SCALAR];
+
+/* returns the highest level the cpu supports */
+KernelLevel kernels_detect(void) {
+#if X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+        return KERNEL_BMI2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return KERNEL_SSE42;
+#endif
+    return KERNEL_SCALAR;
+}
+
+/* picks the kernels once at startup: the best the cpu supports, or the level named by force
+ * (for testing). returns false if force is not a level or the cpu does not support it */
+bool kernels_init(const char *force) {
+    KernelLevel best = kernels_detect();
+
+    if (!force) {
+        kernels = &levels[best];
+        return true;
+    }
+
+    for (uint32_t l = 0; l <= best; l++) {
+        if (strcmp(force, names[l]) == 0) {
+            kernels = &levels[l];
+            return true;
+        }
+    }
+    return false;
+}
+
+/* returns the name of a level (as taken by kernels_init) */
+const char *kernels_name(KernelLevel level) {
+    return level < KERNEL_LEVELS ? names[level] : "unknown";
+}
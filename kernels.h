@@ -0,0 +1,61 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include "code.h"
+#include "defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EMIT_SLACK 8 // writable bytes emit needs past the bytes it completes
+#define PLANES_MAX 16 // widest element split into byte planes
+
+/* instruction set levels, each a superset of the one before. the byte plane shuffles and the
+ * crc are vector (or crc32) instructions. histogram, emit and decode stay the scalar loops,
+ * compiled for the level's target (plus a vector check for runs of one byte in histogram), so
+ * a level is named for what those loops get: the top one is bmi2 though it also needs avx2 */
+typedef enum KernelLevel {
+    KERNEL_SCALAR, // portable c
+    KERNEL_SSE42, // sse4.2 (crc32 instruction, 16-byte shuffles and run checks)
+    KERNEL_BMI2, // bmi2 and avx2 (flagless shifts, 32-byte shuffles and run checks)
+    KERNEL_LEVELS
+} KernelLevel;
+
+/* the hot loops, in the variant picked for this cpu */
+typedef struct Kernels {
+    KernelLevel level;
+
+    /* adds the count of every byte of in to hist */
+    void (*histogram)(const uint8_t *in, uint64_t size, uint64_t hist[static ALPHABET]);
+
+    /* appends the codes for in to the *nacc (< 8) bits in *acc and stores the completed bytes
+     * at out. the bits left over stay in *acc and *nacc. returns the bytes completed */
+    uint64_t (*emit)(const PackedCode table[static ALPHABET], const uint8_t *in, uint64_t size,
+        uint8_t *out, uint64_t *acc, uint32_t *nacc);
+
+    /* crc-32c (castagnoli) of buf, continuing from crc (0 to start) */
+    uint32_t (*crc32c)(uint32_t crc, const uint8_t *buf, uint64_t size);
+
+    /* splits in, elements of n bytes, into n byte planes one after the other in out. plane p
+     * has byte p of every element (so the first size % n planes get a byte of the last,
+     * partial element) */
+    void (*shuffle)(const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out);
+
+    /* the inverse of shuffle */
+    void (*unshuffle)(const uint8_t *in, uint64_t size, uint8_t n, uint8_t *out);
+} Kernels;
+
+/* returns the bytes in plane p of size bytes split into n planes */
+static inline uint32_t plane_size(uint64_t size, uint8_t n, uint8_t p) {
+    return (uint32_t) ((size + n - 1 - p) / n);
+}
+
+extern const Kernels *kernels;
+
+KernelLevel kernels_detect(void);
+
+bool kernels_init(const char *force);
+
+const char *kernels_name(KernelLevel level);
+
+#endif
@@ -33,8 +33,10 @@ Node *node_join(Node *left, Node *right) {
         return NULL; // no left and right. can't join
 
     Node *n = node_create('$', left->frequency + right->frequency); // create a new joint node
-    n->left = left;
-    n->right = right;
+    if (n) {
+        n->left = left;
+        n->right = right;
+    }
 
     return n;
 }
@@ -0,0 +1,387 @@
+#include "parallel.h"
+
+#include "code.h"
+#include "defines.h"
+#include "io.h"
+#include "table.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE 8
+
+/* a byte that more than one thread (or the previous round) contributes bits to */
+typedef struct Piece {
+    uint64_t pos; // index in the round's output
+    uint8_t byte; // bits owned by one writer (others are zero)
+} Piece;
+
+/* work for one encoder thread in a round */
+typedef struct EncodeJob {
+    PackedCode *table; // shared code table
+    uint8_t *in; // the thread's chunk of input
+    uint32_t size; // bytes in the chunk
+    uint64_t *lens; // bit length of every chunk in the round (filled by each thread)
+    uint32_t index; // which chunk
+    uint8_t carry_bits; // bits left over from the previous round (start of the output)
+    uint8_t *out; // the round's output
+    Piece pieces[2]; // shared first and last byte
+    uint8_t npieces;
+} EncodeJob;
+
+/* helper function to compute the exact number of bits the codes for a chunk take */
+static uint64_t chunk_bits(PackedCode *table, uint8_t *in, uint32_t size) {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < size; i++)
+        bits += packed_len(table[in[i]]);
+    return bits;
+}
+
+/* helper function to store a finished byte. bytes that may be shared become pieces */
+static inline void put_byte(
+    EncodeJob *j, uint64_t pos, uint64_t first, bool shared_first, uint8_t b) {
+    if (pos == first && shared_first)
+        j->pieces[j->npieces++] = (Piece) { pos, b };
+    else
+        j->out[pos] = b;
+    return;
+}
+
+/* helper function to run n jobs (size bytes apart in jobs) with worker, each on its own thread.
+ * a job whose thread cannot be started (a thread or pids limit) runs on the calling thread.
+ * returns once every job is done */
+static void run_jobs(void *(*worker)(void *), void *jobs, size_t size, uint32_t n) {
+    pthread_t tids[MAX_THREADS];
+    bool started[MAX_THREADS];
+
+    for (uint32_t k = 0; k < n; k++) {
+        void *job = (uint8_t *) jobs + k * size;
+        started[k] = pthread_create(&tids[k], NULL, worker, job) == 0;
+        if (!started[k])
+            worker(job);
+    }
+    for (uint32_t k = 0; k < n; k++)
+        if (started[k])
+            pthread_join(tids[k], NULL);
+    return;
+}
+
+/* encoder thread, first pass: measure the chunk */
+static void *measure_worker(void *arg) {
+    EncodeJob *j = (EncodeJob *) arg;
+    j->lens[j->index] = chunk_bits(j->table, j->in, j->size);
+    return NULL;
+}
+
+/* encoder thread, second pass (every chunk measured): write at the prefix sum */
+static void *encode_worker(void *arg) {
+    EncodeJob *j = (EncodeJob *) arg;
+
+    /* bit offset of this chunk = leftover bits + lengths of every earlier chunk */
+    uint64_t off = j->carry_bits;
+    for (uint32_t k = 0; k < j->index; k++)
+        off += j->lens[k];
+
+    uint64_t first = off / BYTE, pos = first;
+    bool shared_first = off % BYTE != 0; // previous writer owns the low bits of the first byte
+    uint64_t acc = 0; // bits not yet stored (lsb first, like write_code)
+    uint32_t nacc = off % BYTE;
+
+    j->npieces = 0;
+
+    for (uint32_t i = 0; i < j->size; i++) {
+        PackedCode c = j->table[j->in[i]];
+
+        /* append the whole code. nacc < BYTE so it fits in acc */
+        acc |= packed_bits(c) << nacc;
+        nacc += packed_len(c);
+
+        while (nacc >= BYTE) {
+            put_byte(j, pos++, first, shared_first, (uint8_t) acc);
+            acc >>= BYTE;
+            nacc -= BYTE;
+        }
+    }
+
+    /* partial last byte. the next writer owns its high bits */
+    if (nacc > 0)
+        j->pieces[j->npieces++] = (Piece) { pos, (uint8_t) acc };
+
+    return NULL;
+}
+
+/* writes the codes for every byte of infile (from the current offset) to outfile with up to
+ * threads threads. the output is the same as write_code() followed by flush_codes().
+ * returns the number of bits written or -1 on error */
+int64_t parallel_encode(
+    int infile, int outfile, PackedCode table[static ALPHABET], uint32_t threads) {
+    if (threads == 0 || threads > MAX_THREADS)
+        return -1;
+
+    uint64_t round = (uint64_t) threads * PAR_CHUNK;
+    uint8_t *in = (uint8_t *) malloc(round), *out = NULL;
+    uint64_t out_cap = 0, lens[MAX_THREADS];
+    EncodeJob jobs[MAX_THREADS];
+    int64_t tot_bits = 0;
+    uint8_t carry = 0, carry_bits = 0; // unfinished byte from the previous round
+    uint32_t max_len = 0;
+    bool ok = in != NULL;
+    int tot_read;
+
+    for (uint16_t i = 0; i < ALPHABET; i++)
+        max_len = packed_len(table[i]) > max_len ? packed_len(table[i]) : max_len;
+
+    while (ok && (tot_read = read_bytes(infile, in, round)) > 0) {
+        uint32_t chunk = (tot_read + threads - 1) / threads;
+        uint32_t n = (tot_read + chunk - 1) / chunk; // threads in this round
+
+        /* make room for the longest possible output of the round */
+        uint64_t max_bytes = (carry_bits + (uint64_t) max_len * tot_read) / BYTE + 1;
+        if (max_bytes > out_cap) {
+            free(out);
+            out_cap = max_bytes;
+            if (!(out = (uint8_t *) malloc(out_cap))) {
+                ok = false;
+                break;
+            }
+        }
+
+        for (uint32_t k = 0; k < n; k++) {
+            uint32_t start = k * chunk;
+            jobs[k] = (EncodeJob) { .table = table,
+                .in = in + start,
+                .size = (uint32_t) tot_read - start < chunk ? (uint32_t) tot_read - start : chunk,
+                .lens = lens,
+                .index = k,
+                .carry_bits = carry_bits,
+                .out = out,
+                .npieces = 0 };
+        }
+        run_jobs(measure_worker, jobs, sizeof(EncodeJob), n);
+        run_jobs(encode_worker, jobs, sizeof(EncodeJob), n);
+
+        /* merge the bytes shared between writers (and the leftover from the last round) */
+        uint64_t bits = 0;
+        for (uint32_t k = 0; k < n; k++) {
+            bits += lens[k];
+            for (uint8_t p = 0; p < jobs[k].npieces; p++)
+                out[jobs[k].pieces[p].pos] = 0;
+        }
+        if (carry_bits)
+            out[0] = carry;
+        for (uint32_t k = 0; k < n; k++)
+            for (uint8_t p = 0; p < jobs[k].npieces; p++)
+                out[jobs[k].pieces[p].pos] |= jobs[k].pieces[p].byte;
+
+        /* write whole bytes. keep the unfinished one for the next round */
+        tot_bits += bits;
+        bits += carry_bits;
+        ok = (uint64_t) write_bytes(outfile, out, bits / BYTE) == bits / BYTE;
+        carry_bits = bits % BYTE;
+        carry = carry_bits ? out[bits / BYTE] : 0;
+    }
+
+    free(in);
+    free(out);
+
+    /* ran out of memory or a write fell short */
+    if (!ok)
+        return -1;
+
+    /* flush the last partial byte (zero padded) */
+    if (carry_bits && write_bytes(outfile, &carry, 1) != 1)
+        return -1;
+
+    return tot_bits;
+}
+
+/* work for one speculative decoder thread in a round */
+typedef struct DecodeJob {
+    DecodeTable *table; // shared decode table
+    const uint8_t *in; // the round's window of codes
+    uint64_t nbits; // bits in the window
+    uint64_t start; // bit index to start decoding at (a guess unless it is the first job)
+    uint64_t stop; // decode the symbols whose codes start before this bit index
+    uint8_t *out; // decoded symbols
+    uint64_t cap; // room in out
+    uint64_t count; // symbols in out
+    uint64_t skip; // leading symbols in out that turned out to be wrong
+    uint64_t end; // bit index after the last decoded symbol
+    uint64_t marks[SYNC_MARKS]; // bit index of the first decoded symbols
+    uint32_t nmarks;
+    uint8_t *bridge; // symbols decoded by the fix up between the previous job and this one
+    uint64_t nbridge;
+    uint64_t bridge_cap;
+} DecodeJob;
+
+/* decoder thread: decode from a guessed start, remembering where the first symbols began */
+static void *decode_worker(void *arg) {
+    DecodeJob *j = (DecodeJob *) arg;
+    uint64_t pos = j->start;
+
+    j->count = 0;
+    j->skip = 0;
+    j->nmarks = 0;
+
+    /* one symbol at a time while recording symbol boundaries for the fix up */
+    while (j->nmarks < SYNC_MARKS && pos < j->stop && j->count < j->cap) {
+        j->marks[j->nmarks++] = pos;
+        if (table_decode(j->table, j->in, j->nbits, &pos, j->out + j->count, 1) == 0) {
+            j->nmarks--; // code cut off by the end of the window
+            break;
+        }
+        j->count++;
+    }
+
+    /* codes that end before stop, then the one that crosses it */
+    if (pos < j->stop)
+        j->count += table_decode(
+            j->table, j->in, j->stop, &pos, j->out + j->count, j->cap - j->count);
+    while (pos < j->stop && j->count < j->cap
+           && table_decode(j->table, j->in, j->nbits, &pos, j->out + j->count, 1) == 1)
+        j->count++;
+
+    j->end = pos;
+    return NULL;
+}
+
+/* helper function to add one symbol to the bridge of a job */
+static bool bridge_push(DecodeJob *j, uint8_t symbol) {
+    if (j->nbridge == j->bridge_cap) {
+        uint64_t cap = j->bridge_cap ? 2 * j->bridge_cap : SYNC_MARKS;
+        uint8_t *grown = (uint8_t *) realloc(j->bridge, cap);
+        if (!grown)
+            return false;
+        j->bridge = grown;
+        j->bridge_cap = cap;
+    }
+    j->bridge[j->nbridge++] = symbol;
+    return true;
+}
+
+/* helper function to line a speculative job up with the true end of the previous one.
+ * huffman codes resynchronize quickly, so the true decode usually lands on one of the job's
+ * recorded boundaries within a few symbols. returns the true end of the job or -1 on error */
+static int64_t sync_job(DecodeJob *j, uint64_t e) {
+    uint32_t m = 0;
+    uint8_t symbol;
+
+    j->nbridge = 0;
+
+    while (j->nmarks > 0 && e <= j->marks[j->nmarks - 1]) {
+        while (j->marks[m] < e)
+            m++; // marks are in increasing order
+
+        /* same boundary. everything the job decoded from here on is right */
+        if (j->marks[m] == e) {
+            j->skip = m;
+            return (int64_t) j->end;
+        }
+
+        /* decode one more true symbol into the bridge */
+        if (table_decode(j->table, j->in, j->nbits, &e, &symbol, 1) != 1 || !bridge_push(j, symbol))
+            return -1;
+    }
+
+    /* never synchronized. decode the job again from the true position */
+    j->nbridge = 0;
+    j->start = e;
+    decode_worker(j);
+    return (int64_t) j->end;
+}
+
+/* decodes the single stream codes of infile (after the tree dump) to outfile with up to
+ * threads threads. every thread but the first starts at a guessed bit offset; the guesses are
+ * fixed up in order once the threads are done. comp_bits is set to the bits decoded.
+ * returns the number of symbols decoded (less than nsyms if the input is cut short) or -1 if
+ * a write falls short */
+int64_t parallel_decode(int infile, int outfile, DecodeTable *table, uint64_t nsyms,
+    uint32_t threads, uint64_t *comp_bits) {
+    uint64_t window_size = (uint64_t) threads * PAR_CHUNK;
+    uint8_t *window = (uint8_t *) calloc(window_size + TABLE_SLACK, sizeof(uint8_t));
+    DecodeJob *jobs = (DecodeJob *) calloc(threads, sizeof(DecodeJob));
+    uint64_t have = 0, at = 0, tot_decoded = 0;
+    bool eof = false, written = true;
+
+    *comp_bits = 0;
+
+    while (window && jobs && written && tot_decoded < nsyms) {
+
+        /* slide the unread bytes to the front and refill the window */
+        uint64_t keep = have - at / BYTE;
+        memmove(window, window + at / BYTE, keep);
+        at %= BYTE;
+        if (!eof) {
+            int tot_read = read_bytes(infile, window + keep, window_size - keep);
+            eof = (uint64_t) tot_read < window_size - keep;
+            keep += tot_read;
+        }
+        have = keep;
+        memset(window + have, 0, TABLE_SLACK);
+
+        /* few threads for small windows so that no region is shorter than the longest code */
+        uint64_t nbits = have * BYTE, span = nbits - at;
+        uint32_t n = span / MIN_REGION > threads ? threads : (uint32_t) (span / MIN_REGION);
+        n = n == 0 ? 1 : n;
+
+        bool ok = true;
+        for (uint32_t k = 0; k < n && ok; k++) {
+            DecodeJob *j = &jobs[k];
+            j->table = table;
+            j->in = window;
+            j->nbits = nbits;
+            j->start = at + span * k / n;
+            j->stop = k == n - 1 ? nbits : at + span * (k + 1) / n;
+
+            /* every code is at least one bit */
+            uint64_t cap = j->stop - j->start + 1;
+            if (cap > j->cap) {
+                free(j->out);
+                j->out = (uint8_t *) malloc(cap);
+                j->cap = j->out ? cap : 0;
+                ok = j->out != NULL;
+            }
+        }
+        if (!ok)
+            break;
+
+        run_jobs(decode_worker, jobs, sizeof(DecodeJob), n);
+
+        /* the first job started on a true boundary. line the others up one after another */
+        int64_t e = (int64_t) jobs[0].end;
+        for (uint32_t k = 1; k < n && e >= 0; k++)
+            e = sync_job(&jobs[k], (uint64_t) e);
+        if (e < 0)
+            break;
+
+        /* write the jobs out in order, stopping at nsyms (the padding decodes to junk) */
+        uint64_t before = tot_decoded;
+        for (uint32_t k = 0; k < n && written && tot_decoded < nsyms; k++) {
+            DecodeJob *j = &jobs[k];
+            uint64_t len = j->nbridge < nsyms - tot_decoded ? j->nbridge : nsyms - tot_decoded;
+            written = (uint64_t) write_bytes(outfile, j->bridge, len) == len;
+            tot_decoded += len;
+            len = j->count - j->skip;
+            len = len < nsyms - tot_decoded ? len : nsyms - tot_decoded;
+            written = written && (uint64_t) write_bytes(outfile, j->out + j->skip, len) == len;
+            tot_decoded += len;
+        }
+        *comp_bits += (uint64_t) e - at;
+        at = (uint64_t) e;
+
+        /* no complete code left and nothing more to read */
+        if (tot_decoded == before && eof)
+            break;
+    }
+
+    for (uint32_t k = 0; jobs && k < threads; k++) {
+        free(jobs[k].out);
+        free(jobs[k].bridge);
+    }
+    free(jobs);
+    free(window);
+    return written ? (int64_t) tot_decoded : -1;
+}
@@ -0,0 +1,21 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include "code.h"
+#include "defines.h"
+#include "table.h"
+
+#include <stdint.h>
+
+#define MAX_THREADS 64 // most worker threads for parallel coding
+#define PAR_CHUNK   (256 * BLOCK) // 1MB of input per thread per round
+#define MIN_REGION  (16 * BLOCK * 8) // fewest bits a speculative decoder starts on
+#define SYNC_MARKS  1024 // symbol boundaries remembered to synchronize on
+
+int64_t parallel_encode(
+    int infile, int outfile, PackedCode table[static ALPHABET], uint32_t threads);
+
+int64_t parallel_decode(int infile, int outfile, DecodeTable *table, uint64_t nsyms,
+    uint32_t threads, uint64_t *comp_bits);
+
+#endif
@@ -0,0 +1,162 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* a queued task */
+typedef struct Job {
+    Task fn;
+    void *arg;
+} Job;
+
+/* a fixed set of worker threads fed from a circular queue (grows when full) */
+struct Pool {
+    uint32_t head; // head index
+    uint32_t tail; // tail index
+    uint32_t size; // size of queue
+    uint32_t capacity; // capacity of queue
+    Job *jobs; // queued tasks
+    uint32_t busy; // workers running a task
+    bool stop; // workers exit once the queue is empty
+    uint32_t threads; // number of workers
+    pthread_t *tids; // worker threads
+    pthread_mutex_t lock;
+    pthread_cond_t ready; // a task was queued (or stop was set)
+    pthread_cond_t idle; // queue empty and no task running
+};
+
+/* argument for a worker thread */
+typedef struct Worker {
+    Pool *p;
+    uint32_t index;
+} Worker;
+
+/* worker thread: run tasks till the pool stops */
+static void *worker(void *arg) {
+    Worker *w = (Worker *) arg;
+    Pool *p = w->p;
+    uint32_t index = w->index;
+    free(w);
+
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->size == 0 && !p->stop)
+            pthread_cond_wait(&p->ready, &p->lock);
+        if (p->size == 0)
+            break; // stopped and nothing left to do
+
+        Job job = p->jobs[p->head];
+        p->head = (p->head + 1) % p->capacity;
+        p->size--;
+        p->busy++;
+
+        pthread_mutex_unlock(&p->lock);
+        job.fn(job.arg, index);
+        pthread_mutex_lock(&p->lock);
+
+        p->busy--;
+        if (p->size == 0 && p->busy == 0)
+            pthread_cond_broadcast(&p->idle);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+/* constructor for a pool of threads workers */
+Pool *pool_create(uint32_t threads) {
+    Pool *p = (Pool *) calloc(1, sizeof(Pool));
+
+    if (p) {
+        p->capacity = 64;
+        p->jobs = (Job *) calloc(p->capacity, sizeof(Job));
+        p->tids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+        if (!p->jobs || !p->tids || threads == 0) {
+            free(p->jobs);
+            free(p->tids);
+            free(p);
+            return NULL;
+        }
+
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->ready, NULL);
+        pthread_cond_init(&p->idle, NULL);
+
+        for (uint32_t i = 0; i < threads; i++) {
+            Worker *w = (Worker *) malloc(sizeof(Worker));
+            if (!w)
+                break;
+            w->p = p;
+            w->index = i;
+            if (pthread_create(&p->tids[p->threads], NULL, worker, w) != 0) {
+                free(w);
+                break;
+            }
+            p->threads++;
+        }
+    }
+
+    return p;
+}
+
+/* destructor for a pool. queued tasks are run before the workers exit */
+void pool_delete(Pool **p) {
+    if (p && *p) {
+        pthread_mutex_lock(&(*p)->lock);
+        (*p)->stop = true;
+        pthread_cond_broadcast(&(*p)->ready);
+        pthread_mutex_unlock(&(*p)->lock);
+
+        for (uint32_t i = 0; i < (*p)->threads; i++)
+            pthread_join((*p)->tids[i], NULL);
+
+        pthread_mutex_destroy(&(*p)->lock);
+        pthread_cond_destroy(&(*p)->ready);
+        pthread_cond_destroy(&(*p)->idle);
+        free((*p)->jobs);
+        free((*p)->tids);
+        free(*p);
+        *p = NULL;
+    }
+    return;
+}
+
+/* queues fn(arg) to run on a worker. returns false if out of memory */
+bool pool_submit(Pool *p, Task fn, void *arg) {
+    pthread_mutex_lock(&p->lock);
+
+    /* queue full. unwrap it into a bigger array */
+    if (p->size == p->capacity) {
+        Job *grown = (Job *) malloc(2 * p->capacity * sizeof(Job));
+        if (!grown) {
+            pthread_mutex_unlock(&p->lock);
+            return false;
+        }
+        for (uint32_t i = 0; i < p->size; i++)
+            grown[i] = p->jobs[(p->head + i) % p->capacity];
+        free(p->jobs);
+        p->jobs = grown;
+        p->head = 0;
+        p->tail = p->size;
+        p->capacity *= 2;
+    }
+
+    p->jobs[p->tail] = (Job) { fn, arg };
+    p->tail = (p->tail + 1) % p->capacity;
+    p->size++;
+    pthread_cond_signal(&p->ready);
+
+    pthread_mutex_unlock(&p->lock);
+    return true;
+}
+
+/* waits till every queued task has run */
+void pool_wait(Pool *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->size > 0 || p->busy > 0)
+        pthread_cond_wait(&p->idle, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+    return;
+}
@@ -0,0 +1,20 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct Pool Pool;
+
+/* a task gets its argument and the index of the worker running it */
+typedef void (*Task)(void *arg, uint32_t worker);
+
+Pool *pool_create(uint32_t threads);
+
+void pool_delete(Pool **p);
+
+bool pool_submit(Pool *p, Task fn, void *arg);
+
+void pool_wait(Pool *p);
+
+#endif
@@ -0,0 +1,225 @@
+#include "prof.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the counters read for every phase */
+enum {
+    CYCLES,
+    INSTRUCTIONS,
+    BRANCH_MISSES,
+    CACHE_MISSES,
+    TASK_CLOCK, // cpu time in ns (software, so there even where the hardware ones are not)
+    PAGE_FAULTS,
+    COUNTERS
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+/* what a phase added up to */
+typedef struct Phase {
+    const char *name;
+    uint64_t ns; // wall clock
+    uint64_t counts[COUNTERS];
+} Phase;
+
+/* counters of this process (and the threads it starts) and the phases measured with them */
+struct Prof {
+    int fds[COUNTERS]; // -1 for a counter that could not be opened
+    bool kernel; // counting in the kernel too (syscalls), not only in user space
+    int err; // errno of the first hardware counter that failed
+    uint64_t start_ns; // of the phase running
+    uint64_t start[COUNTERS];
+    Phase phases[PROF_PHASES];
+    uint32_t nphases;
+};
+
+/* counter values as read with the times the counter was enabled and running */
+typedef struct Reading {
+    uint64_t value;
+    uint64_t enabled;
+    uint64_t running;
+} Reading;
+
+/* helper function to get a monotonic time in ns */
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* helper function to open a counter of this process, inherited by the threads it starts (a
+ * thread's counts are added when it ends). returns the fd or -1 */
+static int open_counter(uint32_t type, uint64_t config, bool kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = !kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* helper function to read every counter, scaled up for the time it was multiplexed out */
+static void read_counters(const Prof *p, uint64_t counts[static COUNTERS]) {
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        Reading r = { 0, 0, 0 };
+        counts[c] = 0;
+        if (p->fds[c] != -1 && read(p->fds[c], &r, sizeof(r)) == sizeof(r) && r.running > 0)
+            counts[c] = (uint64_t) ((double) r.value * r.enabled / r.running);
+    }
+    return;
+}
+
+/* constructor for a profile. counters the kernel does not allow (perf_event_paranoid, no pmu
+ * in a vm or container) are left out: kernel counting is dropped first, then the counter.
+ * returns NULL if out of memory */
+Prof *prof_create(void) {
+    Prof *p = (Prof *) calloc(1, sizeof(Prof));
+    if (!p)
+        return NULL;
+
+    p->kernel = true;
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        p->fds[c] = open_counter(events[c].type, events[c].config, p->kernel);
+        if (p->fds[c] == -1 && (errno == EACCES || errno == EPERM) && p->kernel) {
+            p->kernel = false; // user space only for every counter, so they add up alike
+            for (uint32_t o = 0; o < c; o++) {
+                close(p->fds[o]);
+                p->fds[o] = open_counter(events[o].type, events[o].config, false);
+            }
+            p->fds[c] = open_counter(events[c].type, events[c].config, false);
+        }
+        if (p->fds[c] == -1 && events[c].type == PERF_TYPE_HARDWARE && p->err == 0)
+            p->err = errno;
+    }
+    return p;
+}
+
+/* destructor for a profile */
+void prof_delete(Prof **p) {
+    if (p && *p) {
+        for (uint32_t c = 0; c < COUNTERS; c++)
+            if ((*p)->fds[c] != -1)
+                close((*p)->fds[c]);
+        free(*p);
+        *p = NULL;
+    }
+    return;
+}
+
+/* starts a phase (p may be NULL: no profile) */
+void prof_begin(Prof *p) {
+    if (!p)
+        return;
+    read_counters(p, p->start);
+    p->start_ns = now_ns();
+    return;
+}
+
+/* ends the phase begun last, adding it to the phase named phase (a string that outlives p) */
+void prof_end(Prof *p, const char *phase) {
+    if (!p)
+        return;
+    uint64_t ns = now_ns(), counts[COUNTERS];
+    read_counters(p, counts);
+
+    Phase *ph = NULL;
+    for (uint32_t i = 0; !ph && i < p->nphases; i++)
+        ph = strcmp(p->phases[i].name, phase) == 0 ? &p->phases[i] : NULL;
+    if (!ph && p->nphases == PROF_PHASES)
+        return; // no room for another phase
+    if (!ph) {
+        ph = &p->phases[p->nphases++];
+        ph->name = phase;
+    }
+
+    ph->ns += ns - p->start_ns;
+    for (uint32_t c = 0; c < COUNTERS; c++)
+        ph->counts[c] += counts[c] - p->start[c];
+    return;
+}
+
+/* helper function to print a count, or - if its counter is not there */
+static void print_count(const Prof *p, uint32_t c, uint64_t v, int width) {
+    if (p->fds[c] == -1)
+        fprintf(stderr, " %*s", width, "-");
+    else
+        fprintf(stderr, " %*" PRIu64, width, v);
+    return;
+}
+
+/* helper function to print a ratio, or - if it cannot be worked out */
+static void print_ratio(bool there, uint64_t num, uint64_t den, int width) {
+    if (!there || den == 0)
+        fprintf(stderr, " %*s", width, "-");
+    else
+        fprintf(stderr, " %*.2lf", width, (double) num / den);
+    return;
+}
+
+/* helper function to print the row of one phase */
+static void print_phase(const Prof *p, const Phase *ph, uint64_t in_bytes, uint64_t out_bytes) {
+    const uint64_t *n = ph->counts;
+    fprintf(stderr, "%-10s %9.2lf", ph->name, ph->ns / 1e6);
+    if (p->fds[TASK_CLOCK] == -1)
+        fprintf(stderr, " %9s", "-");
+    else
+        fprintf(stderr, " %9.2lf", n[TASK_CLOCK] / 1e6);
+    print_count(p, CYCLES, n[CYCLES], 13);
+    print_count(p, INSTRUCTIONS, n[INSTRUCTIONS], 13);
+    print_ratio(p->fds[CYCLES] != -1 && p->fds[INSTRUCTIONS] != -1, n[INSTRUCTIONS], n[CYCLES], 5);
+    print_count(p, BRANCH_MISSES, n[BRANCH_MISSES], 11);
+    print_count(p, CACHE_MISSES, n[CACHE_MISSES], 11);
+    print_count(p, PAGE_FAULTS, n[PAGE_FAULTS], 8);
+    print_ratio(p->fds[CYCLES] != -1, n[CYCLES], in_bytes, 9);
+    print_ratio(p->fds[CYCLES] != -1, n[CYCLES], out_bytes, 9);
+    fprintf(stderr, "\n");
+    return;
+}
+
+/* prints every phase and their total to stderr. cycles per byte are given for the in_bytes read
+ * and the out_bytes written */
+void prof_report(Prof *p, uint64_t in_bytes, uint64_t out_bytes) {
+    if (!p)
+        return;
+
+    if (p->err != 0)
+        fprintf(stderr, "Hardware counters unavailable (%s): software counters only.\n",
+            strerror(p->err));
+    fprintf(stderr, "Profile (%s):\n", p->kernel ? "user and kernel" : "user space only");
+    fprintf(stderr, "%-10s %9s %9s %13s %13s %5s %11s %11s %8s %9s %9s\n", "phase", "wall ms",
+        "cpu ms", "cycles", "instructions", "ipc", "br misses", "$ misses", "faults", "cyc/in B",
+        "cyc/out B");
+
+    Phase total = { .name = "total", .ns = 0, .counts = { 0 } };
+    for (uint32_t i = 0; i < p->nphases; i++) {
+        print_phase(p, &p->phases[i], in_bytes, out_bytes);
+        total.ns += p->phases[i].ns;
+        for (uint32_t c = 0; c < COUNTERS; c++)
+            total.counts[c] += p->phases[i].counts[c];
+    }
+    print_phase(p, &total, in_bytes, out_bytes);
+    return;
+}
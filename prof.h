@@ -0,0 +1,20 @@
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stdint.h>
+
+#define PROF_PHASES 8 // phases a profile keeps apart
+
+typedef struct Prof Prof;
+
+Prof *prof_create(void);
+
+void prof_delete(Prof **p);
+
+void prof_begin(Prof *p);
+
+void prof_end(Prof *p, const char *phase);
+
+void prof_report(Prof *p, uint64_t in_bytes, uint64_t out_bytes);
+
+#endif
@@ -0,0 +1,85 @@
+#include "proto.h"
+
+#include "io.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define IO_MAX (1 << 30) // read_bytes and write_bytes take an int
+
+/* connects to the daemon listening on the unix socket at path. returns the fd or -1 */
+int proto_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != -1 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/* writes exactly size bytes. returns false on error */
+bool proto_send_all(int fd, const uint8_t *buf, uint64_t size) {
+    while (size > 0) {
+        int n = size > IO_MAX ? IO_MAX : (int) size;
+        if (write_bytes(fd, (uint8_t *) buf, n) != n)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* reads exactly size bytes. returns false on EOF or error */
+bool proto_recv_all(int fd, uint8_t *buf, uint64_t size) {
+    while (size > 0) {
+        int n = size > IO_MAX ? IO_MAX : (int) size;
+        if (read_bytes(fd, buf, n) != n)
+            return false;
+        buf += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* sends a request or response header (they share a layout) and its payload */
+bool proto_send(int fd, uint32_t magic, uint32_t code, const uint8_t *buf, uint64_t size) {
+    Request r = { .magic = magic, .op = code, .size = size };
+    return proto_send_all(fd, (uint8_t *) &r, sizeof(r)) && proto_send_all(fd, buf, size);
+}
+
+/* sends one request and waits for its response. *out (with room for *cap bytes) is grown as
+ * needed and keeps TABLE_SLACK zeroed bytes past the payload. returns the payload size or -1 */
+int64_t proto_call(
+    int fd, uint32_t op, const uint8_t *in, uint64_t size, uint8_t **out, uint64_t *cap) {
+    Response r;
+
+    if (!proto_send(fd, PROTO_MAGIC, op, in, size)
+        || !proto_recv_all(fd, (uint8_t *) &r, sizeof(r)) || r.magic != PROTO_MAGIC)
+        return -1;
+
+    if (r.size + TABLE_SLACK > *cap) {
+        uint8_t *grown = (uint8_t *) realloc(*out, r.size + TABLE_SLACK);
+        if (!grown)
+            return -1;
+        *out = grown;
+        *cap = r.size + TABLE_SLACK;
+    }
+
+    if (!proto_recv_all(fd, *out, r.size) || r.status != STATUS_OK)
+        return -1;
+    memset(*out + r.size, 0, TABLE_SLACK);
+
+    return (int64_t) r.size;
+}
@@ -0,0 +1,38 @@
+#ifndef __PROTO_H__
+#define __PROTO_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PROTO_MAGIC   0x48554646 // "HUFF" starts every request and response
+#define OP_COMPRESS   1 // payload is data to compress
+#define OP_DECOMPRESS 2 // payload is a compressed file
+#define STATUS_OK     0 // payload is the result
+#define STATUS_ERROR  1 // no payload. the request was bad or failed
+
+/* sent by the client, followed by size bytes of payload */
+typedef struct Request {
+    uint32_t magic;
+    uint32_t op;
+    uint64_t size;
+} Request;
+
+/* sent by the daemon, followed by size bytes of payload */
+typedef struct Response {
+    uint32_t magic;
+    uint32_t status;
+    uint64_t size;
+} Response;
+
+int proto_connect(const char *path);
+
+bool proto_send(int fd, uint32_t magic, uint32_t code, const uint8_t *buf, uint64_t size);
+
+bool proto_send_all(int fd, const uint8_t *buf, uint64_t size);
+
+bool proto_recv_all(int fd, uint8_t *buf, uint64_t size);
+
+int64_t proto_call(int fd, uint32_t op, const uint8_t *in, uint64_t size, uint8_t **out,
+    uint64_t *cap);
+
+#endif
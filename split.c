@@ -0,0 +1,213 @@
+#include "split.h"
+
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+#include "io.h"
+#include "kernels.h"
+#include "node.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BYTE    8
+#define RUN_MIN (4 * BLOCK) // a run of one byte this long gets a segment (and block) of its own
+
+/* returns the bits needed to code hist as one block (block header and tree dump included) */
+uint64_t split_cost(uint64_t hist[static ALPHABET]) {
+    Node *root = build_tree(hist);
+    if (!root)
+        return 0; // nothing to code
+
+    PackedCode table[ALPHABET];
+    build_packed(root, table); // only the codes of present symbols are written
+    delete_tree(&root);
+
+    uint64_t bits = 0;
+    uint16_t unique = 0;
+    for (uint16_t i = 0; i < ALPHABET; i++) {
+        if (hist[i] > 0) {
+            bits += hist[i] * packed_len(table[i]);
+            unique++;
+        }
+    }
+
+    /* codes are padded to a byte. the tree dump has 3 * unique - 1 bytes */
+    bits = (bits + BYTE - 1) / BYTE * BYTE;
+    return bits + BYTE * (sizeof(BlockHeader) + sizeof(uint32_t) + 3 * unique - 1);
+}
+
+/* helper function to append a segment to a growing segment array */
+static Segment *add_segment(Segment *segs, uint32_t *nsegs, uint32_t *cap, Segment seg) {
+    if (*nsegs == *cap) {
+        *cap = *cap ? 2 * *cap : 64;
+        Segment *grown = (Segment *) realloc(segs, *cap * sizeof(Segment));
+        if (!grown) {
+            free(segs);
+            return NULL;
+        }
+        segs = grown;
+    }
+    segs[(*nsegs)++] = seg;
+    return segs;
+}
+
+/* helper function to count the bytes equal to b at the start of buf (at most size) */
+static uint32_t run_length(const uint8_t *buf, uint32_t size, uint8_t b) {
+    uint64_t pattern = 0x0101010101010101ull * b, word;
+    uint32_t n = 0;
+    while (n + sizeof(word) <= size) {
+        memcpy(&word, buf + n, sizeof(word)); // a word at a time
+        if (word != pattern)
+            break;
+        n += sizeof(word);
+    }
+    while (n < size && buf[n] == b)
+        n++;
+    return n;
+}
+
+/* helper function to find the first run of at least RUN_MIN equal bytes in buf. such a run
+ * covers a whole window of RUN_MIN / 2 bytes at a multiple of that, so only those are checked.
+ * returns the start of the run (size if there is none) and sets *len to its length */
+static uint32_t find_run(const uint8_t *buf, uint32_t size, uint32_t *len) {
+    for (uint32_t w = 0; w + RUN_MIN / 2 <= size; w += RUN_MIN / 2) {
+        uint8_t b = buf[w];
+        if (buf[w + RUN_MIN / 2 - 1] != b || memcmp(buf + w, buf + w + 1, RUN_MIN / 2 - 1) != 0)
+            continue; // not all b
+
+        uint32_t start = w, end = w + RUN_MIN / 2;
+        while (start > 0 && buf[start - 1] == b)
+            start--;
+        end += run_length(buf + end, size - end, b);
+        if (end - start >= RUN_MIN) {
+            *len = end - start;
+            return start;
+        }
+    }
+    *len = 0;
+    return size;
+}
+
+/* splits infile into segments that are worth coding with their own huffman tree.
+ * chunks are merged into the current segment greedily while one shared tree is cheaper
+ * than closing the segment and paying for a new block header and tree dump. runs of at least
+ * RUN_MIN equal bytes get segments of their own (coded as run blocks), so a chunk is taken a
+ * piece at a time: the bytes before a run, then the run.
+ * the byte histogram of the whole input is accumulated in hist. returns NULL on error */
+Segment *split_input(int infile, int temp_fd, uint64_t hist[static ALPHABET], uint32_t *nsegs) {
+    uint8_t *buffer = (uint8_t *) calloc(CHUNK, sizeof(uint8_t));
+    uint64_t *cur = (uint64_t *) calloc(ALPHABET, sizeof(uint64_t)); // current segment
+    uint64_t *chunk = (uint64_t *) calloc(ALPHABET, sizeof(uint64_t)); // piece just read
+    uint64_t *merged = (uint64_t *) calloc(ALPHABET, sizeof(uint64_t)); // segment + piece
+
+    Segment *segs = NULL, seg = { 0, 0 };
+    uint32_t cap = 0, pos = 0, len = 0;
+    uint64_t cur_cost = 0, offset = 0;
+    int tot_read = 0;
+    int run = -1; // byte repeated by the current segment if it is a run
+    bool ok = buffer && cur && chunk && merged;
+
+    *nsegs = 0;
+
+    while (ok) {
+        /* read CHUNK till EOF */
+        if (pos == (uint32_t) tot_read) {
+            if ((tot_read = read_bytes(infile, buffer, CHUNK)) <= 0)
+                break;
+            pos = 0;
+
+            /* save stdin input to the temp file (to read the file again later) */
+            if (infile == STDIN_FILENO)
+                write_bytes(temp_fd, buffer, tot_read);
+        }
+
+        /* a run carries on till another byte or till its segment is full */
+        if (run >= 0) {
+            uint32_t room = MAX_SEGMENT - seg.size, left = (uint32_t) tot_read - pos;
+            uint32_t n = run_length(buffer + pos, left < room ? left : room, (uint8_t) run);
+            seg.size += n;
+            hist[run] += n;
+            pos += n;
+            offset += n;
+            if (pos < (uint32_t) tot_read) {
+                ok = (segs = add_segment(segs, nsegs, &cap, seg)) != NULL;
+                seg.size = 0;
+                run = -1;
+            }
+            continue;
+        }
+
+        /* the bytes up to the next run (or the end of the chunk) */
+        uint32_t at = pos + find_run(buffer + pos, (uint32_t) tot_read - pos, &len);
+        uint32_t size = at - pos;
+        if (size > 0) {
+            memset(chunk, 0, ALPHABET * sizeof(uint64_t));
+            kernels->histogram(buffer + pos, size, chunk);
+
+            uint64_t chunk_cost = split_cost(chunk), merged_cost = 0;
+            bool merge = seg.size > 0 && seg.size + size <= MAX_SEGMENT;
+
+            /* only pay for a merged tree if the chunk could join the segment */
+            if (merge) {
+                for (uint16_t i = 0; i < ALPHABET; i++)
+                    merged[i] = cur[i] + chunk[i];
+                merged_cost = split_cost(merged);
+                merge = merged_cost <= cur_cost + chunk_cost;
+            }
+
+            if (merge) {
+                memcpy(cur, merged, ALPHABET * sizeof(uint64_t));
+                cur_cost = merged_cost;
+                seg.size += size;
+            } else {
+                /* distribution changed (or segment full). close the segment, start a new one */
+                if (seg.size > 0)
+                    ok = (segs = add_segment(segs, nsegs, &cap, seg)) != NULL;
+                memcpy(cur, chunk, ALPHABET * sizeof(uint64_t));
+                cur_cost = chunk_cost;
+                seg.offset = offset;
+                seg.size = size;
+            }
+
+            for (uint16_t i = 0; i < ALPHABET; i++)
+                hist[i] += chunk[i];
+            offset += size;
+            pos = at;
+        }
+
+        /* a run starts. close the segment before it */
+        if (ok && len > 0) {
+            if (seg.size > 0)
+                ok = (segs = add_segment(segs, nsegs, &cap, seg)) != NULL;
+            seg.offset = offset;
+            seg.size = 0;
+            run = buffer[at];
+        }
+    }
+
+    /* close the last segment */
+    if (ok && seg.size > 0)
+        ok = (segs = add_segment(segs, nsegs, &cap, seg)) != NULL;
+
+    free(buffer);
+    free(cur);
+    free(chunk);
+    free(merged);
+
+    if (!ok) {
+        free(segs);
+        *nsegs = 0;
+        return NULL;
+    }
+
+    /* empty input still needs a (zero length) array */
+    if (!segs)
+        segs = (Segment *) calloc(1, sizeof(Segment));
+
+    return segs;
+}
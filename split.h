@@ -0,0 +1,17 @@
+#ifndef __SPLIT_H__
+#define __SPLIT_H__
+
+#include "defines.h"
+
+#include <stdint.h>
+
+typedef struct Segment {
+    uint64_t offset; // offset of the first byte of the segment in the input
+    uint32_t size; // bytes in the segment (at most MAX_SEGMENT)
+} Segment;
+
+Segment *split_input(int infile, int temp_fd, uint64_t hist[static ALPHABET], uint32_t *nsegs);
+
+uint64_t split_cost(uint64_t hist[static ALPHABET]);
+
+#endif
@@ -0,0 +1,202 @@
+#include "table.h"
+
+#include "kernels.h"
+#include "node.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE 8
+
+/* one lookup: the symbols whose codes fit in the next TABLE_BITS bits */
+typedef struct TableEntry {
+    uint8_t symbols[TABLE_SYMS]; // decoded symbols in order
+    uint8_t count; // symbols decoded (0 if the first code is longer than TABLE_BITS)
+    uint8_t bits; // bits consumed by all the symbols
+    uint8_t first; // bits consumed by the first symbol only
+    uint8_t pad;
+} TableEntry;
+
+/* a multi-symbol decode table built from a huffman tree */
+struct DecodeTable {
+    Node *root; // tree for codes longer than TABLE_BITS
+    uint32_t span; // bits a lookup or a tree walk can read: the longest code, at least TABLE_BITS
+    TableEntry entries[1 << TABLE_BITS]; // indexed by the next TABLE_BITS bits of input
+};
+
+/* helper function to determine if a node is leaf or not */
+static bool is_leaf(Node *n) {
+    if (n)
+        return (!n->left && !n->right); // no child nodes then true, else false
+    return false;
+}
+
+/* helper function to peek at the next 57 (or more) bits starting at bit index at */
+static inline uint64_t peek_bits(const uint8_t *in, uint64_t at) {
+    uint64_t word;
+    memcpy(&word, in + at / BYTE, sizeof(word)); // little endian: first bit is the lsb
+    return word >> (at % BYTE);
+}
+
+/* helper function to get the longest code of a tree */
+static uint32_t longest_code(Node *n) {
+    if (is_leaf(n))
+        return 0;
+    uint32_t left = longest_code(n->left), right = longest_code(n->right);
+    return 1 + (left > right ? left : right);
+}
+
+/* constructor for a decode table. the tree must outlive the table and be a full tree (as
+ * rebuild_tree checks), which the decode loop relies on instead of checking every code.
+ * returns NULL without a tree */
+DecodeTable *table_create(Node *root) {
+    DecodeTable *t = root ? (DecodeTable *) calloc(1, sizeof(DecodeTable)) : NULL;
+
+    if (t) {
+        t->root = root;
+        t->span = longest_code(root);
+        t->span = t->span < TABLE_BITS ? TABLE_BITS : t->span;
+
+        /* single symbol tree has no codes. table_decode handles it */
+        if (is_leaf(root))
+            return t;
+
+        /* walk the tree with the bits of each index, restarting at the root after a leaf */
+        for (uint32_t i = 0; i < (1 << TABLE_BITS); i++) {
+            TableEntry *e = &t->entries[i];
+            Node *n = root;
+
+            for (uint8_t b = 0; b < TABLE_BITS && e->count < TABLE_SYMS; b++) {
+                n = (i >> b) & 1 ? n->right : n->left; // bit = 1 go down right, else left
+
+                /* reached leaf. store the symbol and restart */
+                if (is_leaf(n)) {
+                    e->symbols[e->count++] = n->symbol;
+                    e->bits = b + 1;
+                    if (e->count == 1)
+                        e->first = b + 1;
+                    n = root;
+                }
+            }
+        }
+    }
+
+    return t;
+}
+
+/* destructor for a decode table (the tree is not freed) */
+void table_delete(DecodeTable **t) {
+    if (t && *t) {
+        free(*t);
+        *t = NULL;
+    }
+    return;
+}
+
+/* helper function to decode one code longer than TABLE_BITS by walking the tree.
+ * returns false (and leaves at alone) if the code runs past nbits */
+static bool walk_code(Node *root, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out) {
+    Node *n = root;
+    uint64_t pos = *at;
+
+    while (!is_leaf(n)) {
+        if (pos >= nbits)
+            return false; // code is cut off
+        n = (in[pos / BYTE] >> (pos % BYTE)) & 1 ? n->right : n->left;
+        pos++;
+    }
+
+    *out = n->symbol;
+    *at = pos;
+    return true;
+}
+
+/* helper function to decode one code longer than TABLE_BITS that is known to end within the
+ * codes. a full tree needs no checks on the way down */
+static inline Node *walk_whole(Node *root, const uint8_t *in, uint64_t *at) {
+    Node *n = root;
+    uint64_t pos = *at;
+
+    while (n->left) {
+        n = (in[pos / BYTE] >> (pos % BYTE)) & 1 ? n->right : n->left;
+        pos++;
+    }
+
+    *at = pos;
+    return n;
+}
+
+/* the decode loop (inlined into each variant so it is compiled for its target) */
+static inline __attribute__((always_inline)) uint64_t decode_loop(
+    DecodeTable *t, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out, uint64_t nsyms) {
+    uint64_t pos = *at, done = 0;
+
+    /* fast path: whole entries, while any code and the output both fit (no checks per code) */
+    while (pos + t->span <= nbits && nsyms - done >= TABLE_SYMS) {
+        const TableEntry *e = &t->entries[peek_bits(in, pos) & ((1 << TABLE_BITS) - 1)];
+
+        /* code longer than the lookup. walk the tree for it */
+        if (e->count == 0) {
+            out[done++] = walk_whole(t->root, in, &pos)->symbol;
+            continue;
+        }
+
+        memcpy(out + done, e->symbols, TABLE_SYMS); // copy them all. only count are kept
+        done += e->count;
+        pos += e->bits;
+    }
+
+    /* slow path: one symbol at a time near the end of the codes or the output */
+    while (done < nsyms && pos < nbits) {
+        const TableEntry *e = &t->entries[peek_bits(in, pos) & ((1 << TABLE_BITS) - 1)];
+
+        if (e->count == 0 || pos + e->first > nbits) {
+            if (!walk_code(t->root, in, nbits, &pos, out + done))
+                break;
+        } else {
+            out[done] = e->symbols[0];
+            pos += e->first;
+        }
+        done++;
+    }
+
+    *at = pos;
+    return done;
+}
+
+static uint64_t decode_scalar(
+    DecodeTable *t, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out, uint64_t nsyms) {
+    return decode_loop(t, in, nbits, at, out, nsyms);
+}
+
+#if defined(__x86_64__)
+/* bmi2 turns the variable shifts and the index mask into single flagless instructions */
+__attribute__((target("bmi,bmi2"))) static uint64_t decode_bmi2(
+    DecodeTable *t, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out, uint64_t nsyms) {
+    return decode_loop(t, in, nbits, at, out, nsyms);
+}
+#else
+#define decode_bmi2 decode_scalar
+#endif
+
+/* decoder for each kernel level */
+static uint64_t (*const decoders[KERNEL_LEVELS])(
+    DecodeTable *, const uint8_t *, uint64_t, uint64_t *, uint8_t *, uint64_t)
+    = { decode_scalar, decode_scalar, decode_bmi2 };
+
+/* decodes up to nsyms symbols from the codes in the first nbits bits of in, starting at bit
+ * *at (which is advanced). in needs TABLE_SLACK readable bytes past the codes. decoding stops
+ * early before a code that does not end within nbits. returns the number of symbols decoded */
+uint64_t table_decode(
+    DecodeTable *t, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out, uint64_t nsyms) {
+
+    /* single symbol tree. the codes are empty */
+    if (is_leaf(t->root)) {
+        memset(out, t->root->symbol, nsyms);
+        return nsyms;
+    }
+
+    return decoders[kernels->level](t, in, nbits, at, out, nsyms);
+}
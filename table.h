@@ -0,0 +1,21 @@
+#ifndef __TABLE_H__
+#define __TABLE_H__
+
+#include "node.h"
+
+#include <stdint.h>
+
+#define TABLE_BITS  11 // bits looked up at once (2048 entries, 16KB)
+#define TABLE_SYMS  4 // most symbols one entry can decode
+#define TABLE_SLACK 8 // readable bytes needed past the end of the codes
+
+typedef struct DecodeTable DecodeTable;
+
+DecodeTable *table_create(Node *root);
+
+void table_delete(DecodeTable **t);
+
+uint64_t table_decode(
+    DecodeTable *t, const uint8_t *in, uint64_t nbits, uint64_t *at, uint8_t *out, uint64_t nsyms);
+
+#endif
@@ -0,0 +1,358 @@
+#include "wide.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE     8
+#define HASH_MUL 0x9e3779b1u // golden ratio multiplier for the symbol hash
+#define SET_BITS 8 // starting size of the symbol set (it doubles when half full)
+
+/* a distinct symbol, its count and its code */
+typedef struct Symbol {
+    uint32_t symbol;
+    uint32_t count; // 0 marks a free slot
+    uint32_t code; // canonical code, bit reversed so its first bit is the lowest
+    uint32_t len;
+} Symbol;
+
+/* open addressing hash set of the symbols present. it grows with the distinct symbols, not
+ * with the alphabet */
+typedef struct SymbolSet {
+    Symbol *slots;
+    uint32_t bits; // 1 << bits slots
+    uint32_t used;
+} SymbolSet;
+
+/* helper function to read a little endian symbol of width bytes */
+static inline uint32_t load_symbol(const uint8_t *p, uint8_t width) {
+    uint32_t v = 0;
+    memcpy(&v, p, width);
+    return v;
+}
+
+/* helper function to find the slot of a symbol (or the free slot it would go in) */
+static inline Symbol *set_find(SymbolSet *set, uint32_t symbol) {
+    uint32_t mask = (1u << set->bits) - 1, i = (symbol * HASH_MUL) >> (32 - set->bits);
+
+    while (set->slots[i].count > 0 && set->slots[i].symbol != symbol)
+        i = (i + 1) & mask;
+    return &set->slots[i];
+}
+
+/* helper function to double the slots of a set. returns false if out of memory */
+static bool set_grow(SymbolSet *set) {
+    SymbolSet grown = { .slots = NULL, .bits = set->bits + 1, .used = set->used };
+    grown.slots = (Symbol *) calloc((size_t) 1 << grown.bits, sizeof(Symbol));
+    if (!grown.slots)
+        return false;
+
+    for (uint32_t i = 0; i < (1u << set->bits); i++)
+        if (set->slots[i].count > 0)
+            *set_find(&grown, set->slots[i].symbol) = set->slots[i];
+
+    free(set->slots);
+    *set = grown;
+    return true;
+}
+
+/* helper function to count one occurrence of a symbol. returns false if out of memory */
+static inline bool set_add(SymbolSet *set, uint32_t symbol) {
+    Symbol *s = set_find(set, symbol);
+    if (s->count++ > 0)
+        return true;
+
+    s->symbol = symbol;
+    return ++set->used * 2 <= (1u << set->bits) || set_grow(set);
+}
+
+/* helper function to order symbols by count (ties by symbol, so the output is repeatable) */
+static int by_count(const void *a, const void *b) {
+    const Symbol *x = (const Symbol *) a, *y = (const Symbol *) b;
+    if (x->count != y->count)
+        return x->count < y->count ? -1 : 1;
+    return (x->symbol > y->symbol) - (x->symbol < y->symbol);
+}
+
+/* helper function to order symbols canonically: by code length, then by symbol */
+static int by_length(const void *a, const void *b) {
+    const Symbol *x = (const Symbol *) a, *y = (const Symbol *) b;
+    if (x->len != y->len)
+        return x->len < y->len ? -1 : 1;
+    return (x->symbol > y->symbol) - (x->symbol < y->symbol);
+}
+
+/* algo credits: in-place calculation of minimum-redundancy codes (moffat and katajainen) */
+/* helper function to turn n weights in increasing order in a into huffman code lengths */
+static void code_lengths(uint32_t *a, int64_t n) {
+    if (n <= 1) {
+        if (n == 1)
+            a[0] = 0; // a lone symbol needs no code
+        return;
+    }
+
+    /* first pass, left to right: pair the two lightest items, setting parent pointers */
+    int64_t root = 0, leaf = 2, next;
+    a[0] += a[1];
+    for (next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = (uint32_t) next;
+        } else {
+            a[next] = a[leaf++];
+        }
+
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = (uint32_t) next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+
+    /* second pass, right to left: depths of the internal nodes */
+    a[n - 2] = 0;
+    for (next = n - 3; next >= 0; next--)
+        a[next] = a[a[next]] + 1;
+
+    /* third pass, right to left: depths of the leaves */
+    int64_t avail = 1, used = 0, depth = 0;
+    root = n - 2;
+    next = n - 1;
+    while (avail > 0) {
+        while (root >= 0 && a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (avail > used) {
+            a[next--] = (uint32_t) depth;
+            avail--;
+        }
+        avail = 2 * used;
+        depth++;
+        used = 0;
+    }
+    return;
+}
+
+/* helper function to reverse the low len bits of code */
+static inline uint32_t reverse(uint64_t code, uint32_t len) {
+    uint32_t r = 0;
+    for (uint32_t b = 0; b < len; b++)
+        r |= (uint32_t) ((code >> b) & 1) << (len - 1 - b);
+    return r;
+}
+
+/* codes size bytes of in as symbols of width bytes with a canonical huffman code. the code
+ * description and the codes are written to out, which holds cap bytes (8 of them as slack for
+ * whole word stores). returns the bytes written or 0 if they do not fit (or on error) */
+uint64_t wide_encode(
+    const uint8_t *in, uint32_t size, uint8_t width, uint8_t *out, uint64_t cap) {
+    if (width < WIDE_MIN || width > WIDE_MAX)
+        return 0;
+
+    uint32_t nwhole = size / width;
+    SymbolSet set = { .slots = NULL, .bits = SET_BITS, .used = 0 };
+    set.slots = (Symbol *) calloc(1u << SET_BITS, sizeof(Symbol));
+    bool ok = set.slots != NULL;
+
+    /* histogram of the symbols present */
+    for (uint32_t i = 0; ok && i < nwhole; i++)
+        ok = set_add(&set, load_symbol(in + (uint64_t) i * width, width));
+
+    Symbol *syms = ok ? (Symbol *) malloc((set.used + 1) * sizeof(Symbol)) : NULL;
+    uint32_t *lens = ok ? (uint32_t *) malloc((set.used + 1) * sizeof(uint32_t)) : NULL;
+    uint64_t written = 0;
+
+    if (syms && lens) {
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < (1u << set.bits); i++)
+            if (set.slots[i].count > 0)
+                syms[n++] = set.slots[i];
+
+        /* code lengths from the counts in increasing order */
+        qsort(syms, n, sizeof(Symbol), by_count);
+        for (uint32_t i = 0; i < n; i++)
+            lens[i] = syms[i].count;
+        code_lengths(lens, n);
+
+        uint32_t max_len = 0;
+        uint64_t bits = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            syms[i].len = lens[i];
+            max_len = lens[i] > max_len ? lens[i] : max_len;
+            bits += (uint64_t) syms[i].count * lens[i];
+        }
+
+        uint64_t desc = sizeof(WideHeader) + max_len * sizeof(uint32_t) + (uint64_t) n * width;
+        written = desc + (bits + BYTE - 1) / BYTE;
+        if (max_len > WIDE_MAX_LEN || written + BYTE > cap)
+            written = 0; // does not fit. the caller codes the block some other way
+    }
+
+    if (written > 0) {
+        uint32_t n = set.used, max_len = 0, counts[WIDE_MAX_LEN + 1] = { 0 };
+        uint64_t next[WIDE_MAX_LEN + 1] = { 0 }, code = 0;
+
+        /* canonical codes: consecutive within a length, in symbol order */
+        qsort(syms, n, sizeof(Symbol), by_length);
+        for (uint32_t i = 0; i < n; i++) {
+            counts[syms[i].len] += syms[i].len > 0; // a lone symbol has length 0 and no code
+            max_len = syms[i].len > max_len ? syms[i].len : max_len;
+        }
+        for (uint32_t len = 1; len <= max_len; len++) {
+            code = (code + counts[len - 1]) << 1;
+            next[len] = code;
+        }
+
+        WideHeader wh = { .width = width,
+            .max_len = (uint8_t) max_len,
+            .tail_size = (uint8_t) (size % width),
+            .tail = { 0 },
+            .pad = 0,
+            .nsyms = n };
+        memcpy(wh.tail, in + (uint64_t) nwhole * width, wh.tail_size);
+
+        uint8_t *dst = out;
+        memcpy(dst, &wh, sizeof(WideHeader));
+        dst += sizeof(WideHeader);
+        memcpy(dst, counts + 1, max_len * sizeof(uint32_t));
+        dst += max_len * sizeof(uint32_t);
+
+        for (uint32_t i = 0; i < n; i++) {
+            Symbol *s = set_find(&set, syms[i].symbol);
+            s->len = syms[i].len;
+            s->code = reverse(next[s->len]++, s->len);
+            memcpy(dst, &syms[i].symbol, width);
+            dst += width;
+        }
+
+        /* append the codes. nacc < 8 and codes of at most WIDE_MAX_LEN bits fit in acc */
+        uint64_t acc = 0;
+        uint32_t nacc = 0;
+        for (uint32_t i = 0; i < nwhole; i++) {
+            Symbol *s = set_find(&set, load_symbol(in + (uint64_t) i * width, width));
+            acc |= (uint64_t) s->code << nacc;
+            nacc += s->len;
+
+            memcpy(dst, &acc, sizeof(acc)); // little endian: first bit is the lsb
+            dst += nacc / BYTE;
+            acc >>= nacc / BYTE * BYTE;
+            nacc %= BYTE;
+        }
+        if (nacc > 0)
+            *dst++ = (uint8_t) acc;
+    }
+
+    free(set.slots);
+    free(syms);
+    free(lens);
+    return written;
+}
+
+/* helper function to peek at the next 57 (or more) bits starting at bit index at */
+static inline uint64_t peek_bits(const uint8_t *in, uint64_t at) {
+    uint64_t word;
+    memcpy(&word, in + at / BYTE, sizeof(word));
+    return word >> (at % BYTE);
+}
+
+/* decodes the size bytes written by wide_encode (in needs 8 readable bytes past them) into the
+ * out_size bytes of out. returns false if they do not describe out_size bytes */
+bool wide_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size) {
+    WideHeader wh;
+    if (size < sizeof(WideHeader))
+        return false;
+    memcpy(&wh, in, sizeof(WideHeader));
+
+    if (wh.width < WIDE_MIN || wh.width > WIDE_MAX || wh.max_len > WIDE_MAX_LEN
+        || wh.tail_size >= wh.width || out_size < wh.tail_size
+        || (out_size - wh.tail_size) % wh.width != 0)
+        return false;
+
+    uint64_t nwhole = (out_size - wh.tail_size) / wh.width;
+    uint64_t desc
+        = sizeof(WideHeader) + wh.max_len * sizeof(uint32_t) + (uint64_t) wh.nsyms * wh.width;
+    if (desc > size || wh.nsyms > nwhole || (nwhole > 0 && wh.nsyms == 0)
+        || (wh.max_len == 0 && wh.nsyms > 1))
+        return false;
+
+    /* first canonical code and first symbol index of every length. the counts must fit */
+    uint32_t counts[WIDE_MAX_LEN + 1] = { 0 };
+    uint64_t first[WIDE_MAX_LEN + 1] = { 0 }, offset[WIDE_MAX_LEN + 1] = { 0 };
+    uint64_t code = 0, index = 0;
+    memcpy(counts + 1, in + sizeof(WideHeader), wh.max_len * sizeof(uint32_t));
+    for (uint32_t len = 1; len <= wh.max_len; len++) {
+        code <<= 1;
+        first[len] = code;
+        offset[len] = index;
+        code += counts[len];
+        index += counts[len];
+        if (code > ((uint64_t) 1 << len))
+            return false; // more codes than the length allows
+    }
+    if (wh.max_len > 0 && index != wh.nsyms)
+        return false;
+
+    uint32_t *syms = (uint32_t *) calloc(wh.nsyms + 1, sizeof(uint32_t));
+    uint32_t *lut = (uint32_t *) calloc(1 << WIDE_BITS, sizeof(uint32_t));
+    bool ok = syms && lut;
+
+    if (ok) {
+        const uint8_t *p = in + sizeof(WideHeader) + wh.max_len * sizeof(uint32_t);
+        for (uint32_t i = 0; i < wh.nsyms; i++)
+            syms[i] = load_symbol(p + (uint64_t) i * wh.width, wh.width);
+
+        /* every index whose low bits are a short code decodes it: (symbol index << 6) | len */
+        for (uint32_t len = 1; len <= wh.max_len && len <= WIDE_BITS; len++) {
+            for (uint32_t j = 0; j < counts[len]; j++) {
+                uint32_t r = reverse(first[len] + j, len);
+                for (uint32_t k = r; k < (1u << WIDE_BITS); k += 1u << len)
+                    lut[k] = (uint32_t) (offset[len] + j) << 6 | len;
+            }
+        }
+    }
+
+    const uint8_t *codes = in + desc;
+    uint64_t nbits = (size - desc) * BYTE, pos = 0;
+
+    for (uint64_t i = 0; ok && i < nwhole; i++) {
+        uint64_t idx = 0;
+
+        /* a lone symbol has no code */
+        if (wh.max_len > 0) {
+            uint64_t bits = peek_bits(codes, pos);
+            uint32_t e = lut[bits & ((1 << WIDE_BITS) - 1)], len;
+
+            if (e > 0) {
+                len = e & 63;
+                idx = e >> 6;
+            } else {
+                /* longer than the lookup. canonical codes of each length are consecutive */
+                code = 0;
+                for (len = 1; len <= wh.max_len; len++) {
+                    code = code << 1 | ((bits >> (len - 1)) & 1);
+                    if (code - first[len] < counts[len])
+                        break;
+                }
+                if (len > wh.max_len) {
+                    ok = false;
+                    break;
+                }
+                idx = offset[len] + (code - first[len]);
+            }
+
+            pos += len;
+            ok = pos <= nbits;
+        }
+        memcpy(out + i * wh.width, &syms[idx], wh.width);
+    }
+
+    if (ok)
+        memcpy(out + nwhole * wh.width, wh.tail, wh.tail_size);
+
+    free(syms);
+    free(lut);
+    return ok;
+}
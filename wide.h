@@ -0,0 +1,26 @@
+#ifndef __WIDE_H__
+#define __WIDE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WIDE_MIN     2 // narrowest wide symbol in bytes
+#define WIDE_MAX     4 // widest wide symbol in bytes
+#define WIDE_MAX_LEN 32 // longest code (blocks of at most MAX_SEGMENT bytes stay below)
+#define WIDE_BITS    11 // bits looked up at once when decoding
+
+/* start of a wide block body: the canonical code description, then the codes */
+typedef struct WideHeader {
+    uint8_t width; // bytes per symbol (little endian)
+    uint8_t max_len; // longest code. followed by the number of codes of each length 1..max_len
+    uint8_t tail_size; // bytes at the end of the block that do not make a whole symbol
+    uint8_t tail[WIDE_MAX - 1]; // those bytes (stored as is)
+    uint16_t pad;
+    uint32_t nsyms; // distinct symbols. they follow the lengths in canonical order
+} WideHeader;
+
+uint64_t wide_encode(const uint8_t *in, uint32_t size, uint8_t width, uint8_t *out, uint64_t cap);
+
+bool wide_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size);
+
+#endif
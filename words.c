@@ -0,0 +1,250 @@
+#include "words.h"
+
+#include "defines.h"
+#include "wide.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ID_WIDTH  2 // bytes per token id
+#define MIN_COUNT 2 // a token seen fewer times is coded as its bytes
+#define FNV_BASIS 0x811c9dc5u
+#define FNV_PRIME 0x01000193u
+#define SET_BITS  12 // starting size of the token set (it doubles when half full)
+
+/* a distinct token of the input: where it was first seen, its count and its id */
+typedef struct Token {
+    const uint8_t *text;
+    uint32_t hash;
+    uint32_t count; // 0 marks a free slot
+    uint16_t id; // ALPHABET + index in the vocabulary, or 0 if not in it
+    uint8_t len;
+} Token;
+
+/* open addressing hash set of the tokens, grown like the symbol set of the wide coder */
+typedef struct TokenSet {
+    Token *slots;
+    uint32_t bits; // 1 << bits slots
+    uint32_t used;
+} TokenSet;
+
+/* helper function to tell word bytes (letters, digits, '_' and utf-8) from separators */
+static inline bool is_word(uint8_t b) {
+    return (uint8_t) ((b | 0x20) - 'a') < 26 || (uint8_t) (b - '0') < 10 || b == '_' || b >= 0x80;
+}
+
+/* helper function to get the length of the token at in[at]: a run of word bytes or of
+ * separators, cut at WORDS_MAX_LEN */
+static inline uint8_t token_len(const uint8_t *in, uint32_t at, uint32_t size) {
+    bool word = is_word(in[at]);
+    uint32_t end = at + 1, stop = size - at < WORDS_MAX_LEN ? size : at + WORDS_MAX_LEN;
+    while (end < stop && is_word(in[end]) == word)
+        end++;
+    return (uint8_t) (end - at);
+}
+
+/* helper function to hash a token (fnv-1a) */
+static inline uint32_t token_hash(const uint8_t *text, uint8_t len) {
+    uint32_t h = FNV_BASIS;
+    for (uint8_t i = 0; i < len; i++)
+        h = (h ^ text[i]) * FNV_PRIME;
+    return h;
+}
+
+/* helper function to find the slot of a token (or the free slot it would go in) */
+static inline Token *set_find(TokenSet *set, const uint8_t *text, uint8_t len, uint32_t hash) {
+    uint32_t mask = (1u << set->bits) - 1, i = hash & mask;
+
+    while (set->slots[i].count > 0
+           && (set->slots[i].hash != hash || set->slots[i].len != len
+               || memcmp(set->slots[i].text, text, len) != 0))
+        i = (i + 1) & mask;
+    return &set->slots[i];
+}
+
+/* helper function to double the slots of a set. returns false if out of memory */
+static bool set_grow(TokenSet *set) {
+    TokenSet grown = { .slots = NULL, .bits = set->bits + 1, .used = set->used };
+    grown.slots = (Token *) calloc((size_t) 1 << grown.bits, sizeof(Token));
+    if (!grown.slots)
+        return false;
+
+    for (uint32_t i = 0; i < (1u << set->bits); i++) {
+        Token *t = &set->slots[i];
+        if (t->count > 0)
+            *set_find(&grown, t->text, t->len, t->hash) = *t;
+    }
+
+    free(set->slots);
+    *set = grown;
+    return true;
+}
+
+/* helper function to count one occurrence of a token. returns false if out of memory */
+static inline bool set_add(TokenSet *set, const uint8_t *text, uint8_t len) {
+    uint32_t hash = token_hash(text, len);
+    Token *t = set_find(set, text, len, hash);
+    if (t->count++ > 0)
+        return true;
+
+    *t = (Token) { .text = text, .hash = hash, .count = 1, .id = 0, .len = len };
+    return ++set->used * 2 <= (1u << set->bits) || set_grow(set);
+}
+
+/* helper function to order tokens by the bytes they save, most first */
+static int by_saving(const void *a, const void *b) {
+    const Token *x = *(const Token *const *) a, *y = *(const Token *const *) b;
+    uint64_t sx = (uint64_t) x->count * x->len, sy = (uint64_t) y->count * y->len;
+    return (sx < sy) - (sx > sy);
+}
+
+/* helper function to order tokens by their bytes (a shorter token before the ones it starts) */
+static int by_text(const void *a, const void *b) {
+    const Token *x = *(const Token *const *) a, *y = *(const Token *const *) b;
+    int c = memcmp(x->text, y->text, x->len < y->len ? x->len : y->len);
+    return c != 0 ? c : x->len - y->len;
+}
+
+/* codes size bytes of in as word and separator tokens: tokens seen at least MIN_COUNT times
+ * (up to WORDS_MAX_VOCAB of them, the ones saving the most bytes) form a vocabulary and the
+ * rest are coded as their bytes. the ids go through the wide coder. out holds cap bytes (8 of
+ * them as slack). returns the bytes written or 0 if they do not fit, there is no vocabulary or
+ * on error */
+uint64_t words_encode(const uint8_t *in, uint32_t size, uint8_t *out, uint64_t cap) {
+    TokenSet set = { .slots = NULL, .bits = SET_BITS, .used = 0 };
+    set.slots = (Token *) calloc(1u << SET_BITS, sizeof(Token));
+    bool ok = set.slots != NULL;
+
+    /* the tokens and their counts */
+    for (uint32_t at = 0; ok && at < size;) {
+        uint8_t len = token_len(in, at, size);
+        ok = set_add(&set, in + at, len);
+        at += len;
+    }
+
+    /* the vocabulary: tokens of more than a byte seen often enough */
+    Token **vocab = ok ? (Token **) malloc((set.used + 1) * sizeof(Token *)) : NULL;
+    uint32_t nwords = 0;
+    for (uint32_t i = 0; vocab && i < (1u << set.bits); i++) {
+        Token *t = &set.slots[i];
+        if (t->count >= MIN_COUNT && t->len > 1)
+            vocab[nwords++] = t;
+    }
+    if (nwords > WORDS_MAX_VOCAB) {
+        qsort(vocab, nwords, sizeof(Token *), by_saving);
+        nwords = WORDS_MAX_VOCAB;
+    }
+
+    /* front coded in byte order, which also gives the ids */
+    uint64_t vocab_size = 0;
+    uint8_t *dst = out + sizeof(WordsHeader);
+    if (vocab)
+        qsort(vocab, nwords, sizeof(Token *), by_text);
+    for (uint32_t i = 0; vocab && i < nwords; i++) {
+        Token *t = vocab[i], *prev = i > 0 ? vocab[i - 1] : NULL;
+        uint8_t shared = 0;
+        while (prev && shared < prev->len && shared < t->len
+               && prev->text[shared] == t->text[shared])
+            shared++;
+        if (sizeof(WordsHeader) + vocab_size + 2 + t->len - shared > cap) {
+            nwords = 0; // the vocabulary alone does not fit
+            break;
+        }
+        dst[vocab_size++] = shared;
+        dst[vocab_size++] = (uint8_t) (t->len - shared);
+        memcpy(dst + vocab_size, t->text + shared, t->len - shared);
+        vocab_size += t->len - shared;
+        t->id = (uint16_t) (ALPHABET + i);
+    }
+
+    /* the ids: a token's own, or its bytes */
+    uint16_t *ids = nwords > 0 ? (uint16_t *) malloc((uint64_t) size * sizeof(uint16_t)) : NULL;
+    uint32_t nsyms = 0;
+    for (uint32_t at = 0; ids && at < size;) {
+        uint8_t len = token_len(in, at, size);
+        Token *t = set_find(&set, in + at, len, token_hash(in + at, len));
+        if (t->id > 0) {
+            ids[nsyms++] = t->id;
+        } else {
+            for (uint8_t i = 0; i < len; i++)
+                ids[nsyms++] = in[at + i];
+        }
+        at += len;
+    }
+
+    uint64_t desc = sizeof(WordsHeader) + vocab_size, written = 0;
+    if (ids && desc < cap) {
+        uint64_t coded
+            = wide_encode((uint8_t *) ids, nsyms * ID_WIDTH, ID_WIDTH, out + desc, cap - desc);
+        WordsHeader wh = { .nwords = nwords, .vocab_size = (uint32_t) vocab_size, .nsyms = nsyms };
+        memcpy(out, &wh, sizeof(WordsHeader));
+        written = coded > 0 ? desc + coded : 0;
+    }
+
+    free(set.slots);
+    free(vocab);
+    free(ids);
+    return written;
+}
+
+/* decodes the size bytes written by words_encode (in needs 8 readable bytes past them) into the
+ * out_size bytes of out. returns false if they do not describe out_size bytes */
+bool words_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size) {
+    WordsHeader wh;
+    if (size < sizeof(WordsHeader))
+        return false;
+    memcpy(&wh, in, sizeof(WordsHeader));
+    if (wh.nwords > WORDS_MAX_VOCAB || wh.vocab_size > size - sizeof(WordsHeader)
+        || wh.nsyms > out_size)
+        return false;
+
+    /* the vocabulary, token i at i * WORDS_MAX_LEN (it starts like the one before it) */
+    uint8_t *lens = (uint8_t *) malloc(wh.nwords + 1);
+    uint8_t *text = (uint8_t *) malloc((uint64_t) wh.nwords * WORDS_MAX_LEN + 1);
+    uint16_t *ids = (uint16_t *) malloc((uint64_t) wh.nsyms * sizeof(uint16_t) + 1);
+    bool ok = lens && text && ids;
+
+    const uint8_t *p = in + sizeof(WordsHeader), *end = p + wh.vocab_size;
+    for (uint32_t i = 0; ok && i < wh.nwords; i++) {
+        uint8_t shared = p + 2 <= end ? p[0] : 0, rest = p + 2 <= end ? p[1] : 0;
+        ok = p + 2 <= end && shared <= (i > 0 ? lens[i - 1] : 0)
+             && shared + rest <= WORDS_MAX_LEN && shared + rest > 1 && end - p - 2 >= rest;
+        if (!ok)
+            break;
+        uint8_t *t = text + (uint64_t) i * WORDS_MAX_LEN;
+        if (i > 0)
+            memcpy(t, t - WORDS_MAX_LEN, shared);
+        memcpy(t + shared, p + 2, rest);
+        lens[i] = (uint8_t) (shared + rest);
+        p += 2 + rest;
+    }
+    ok = ok && p == end;
+
+    /* the ids, then the bytes they stand for */
+    uint64_t desc = sizeof(WordsHeader) + wh.vocab_size;
+    ok = ok && wide_decode(in + desc, size - desc, (uint8_t *) ids, wh.nsyms * ID_WIDTH);
+
+    uint32_t o = 0;
+    for (uint32_t i = 0; ok && i < wh.nsyms; i++) {
+        uint32_t id = ids[i];
+        if (id < ALPHABET) {
+            ok = o < out_size;
+            if (ok)
+                out[o++] = (uint8_t) id;
+            continue;
+        }
+        id -= ALPHABET;
+        uint32_t n = id < wh.nwords ? lens[id] : 0;
+        ok = n > 0 && n <= out_size - o;
+        if (ok)
+            memcpy(out + o, text + (uint64_t) id * WORDS_MAX_LEN, n);
+        o += n;
+    }
+
+    free(lens);
+    free(text);
+    free(ids);
+    return ok && o == out_size;
+}
@@ -0,0 +1,26 @@
+#ifndef __WORDS_H__
+#define __WORDS_H__
+
+#include "defines.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WORDS_MIN       1024 // smallest block worth tokenizing
+#define WORDS_MAX_LEN   32 // longest token (longer runs are cut)
+#define WORDS_MAX_VOCAB (65536 - ALPHABET) // tokens in a vocabulary (ids are 16 bits)
+
+/* start of a words block body: the vocabulary (front coded: bytes shared with the entry before,
+ * bytes that follow and those bytes), then a wide block (width 2) of the token ids. ids below
+ * ALPHABET are bytes that are not part of a vocabulary token */
+typedef struct WordsHeader {
+    uint32_t nwords; // tokens in the vocabulary, sorted. token i has id ALPHABET + i
+    uint32_t vocab_size; // bytes of the front coded vocabulary
+    uint32_t nsyms; // ids coded
+} WordsHeader;
+
+uint64_t words_encode(const uint8_t *in, uint32_t size, uint8_t *out, uint64_t cap);
+
+bool words_decode(const uint8_t *in, uint64_t size, uint8_t *out, uint32_t out_size);
+
+#endif